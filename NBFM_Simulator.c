@@ -23,8 +23,9 @@
 // #define TESTING "this is the simulation. #UNDEF for the real thing" 
 // #define  DBG_LOGGING "used during testing to log debug info"
 
-// The variable field width operator (%*s) in the printf library does not work for the ATMEGA328.
-// This is the reason you will see the complex string hack in the output routines
+// The display lines are not built with sprintf, that is slow and large on the ATMEGA328 (and
+// the variable field width operator (%*s) does not work). See the Formatting section in the
+// output functions, the menu entries carry a format descriptor for their value.
 
 /* How to add a menu item :
 
@@ -37,6 +38,8 @@
    - Add entry to ProcessingHandler/Selector Button/Select pushed during Value editing
 
    - Add entry to BottomLinePrinter
+   - A stored value: keep it below the "Back to main" entry of its submenu,
+     update PERSISTENTCOUNT and add an integrity check to readPersistentStorage
  */
 // }}}
 // {{{ includes
@@ -55,6 +58,7 @@
 #include <unistd.h>
 #include <sys/select.h>
 #include <termios.h>
+#include <stdarg.h>
 
 #else
 
@@ -64,6 +68,7 @@
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
 
 #endif
 
@@ -95,44 +100,108 @@
 #define MAROTARYTYPE        (MAINMENU+12)
 #define MAREMOTEENABLE      (MAINMENU+13)
 #define MAFRONTENABLE       (MAINMENU+14)
-#define MABACK2MAIN         (MAINMENU+15)
-#define MAFACTORYRESET      (MAINMENU+16)
+#define MAFASTLOCK          (MAINMENU+15)
+#define MARASTER            (MAINMENU+16)
+#define MASMCALIB           (MAINMENU+17)
+#define MABACK2MAIN         (MAINMENU+18)
+#define MAFACTORYRESET      (MAINMENU+19)
+// }}}
+// {{{ Squelch submenu states, entered from MMUTELEVEL
+#define SUBMENU2            (MAINMENU+20)
+#define MSQOPEN             (MAINMENU+20)
+#define MSQCLOSE            (MAINMENU+21)
+#define MSQMINOPEN          (MAINMENU+22)
+#define MSQTAIL             (MAINMENU+23)
+#define MSQAUTO             (MAINMENU+24)
+#define MSQMARGIN           (MAINMENU+25)
+#define MSQBACK2MAIN        (MAINMENU+26)
+// }}}
+// {{{ S-meter calibration submenu states, entered from MASMCALIB
+#define SUBMENU3            (MAINMENU+27)
+#define MSMCALLOW           (MAINMENU+27)
+#define MSMCALHIGH          (MAINMENU+28)
+#define MSMBACK2SET         (MAINMENU+29)
+// }}}
+// {{{ Scanning submenu states, entered from MSCAN
+#define SUBMENU4            (MAINMENU+30)
+#define MSCBAND             (MAINMENU+30)
+#define MSCMEMORY           (MAINMENU+31)
+#define MSCSAVE             (MAINMENU+32)
+#define MSCBACK2MAIN        (MAINMENU+33)
+
+// menu values up to and including MSMCALHIGH are kept in eeprom, one dword each.
+// The open level lives in the MMUTELEVEL slot, the MSQOPEN slot is unused.
+#define PERSISTENTCOUNT     (MSMCALHIGH+1)
 // }}}
 
 // }}} States
 // {{{ factory settings
 
-#define IF                  69300UL     // in kHz
-#define INITIAL_FREQUENCY   1298200UL   // in kHz    
-#define INITIAL_SHIFT       -28000L     // in kHz
+#define IF                  69300000UL  // in Hz
+#define INITIAL_FREQUENCY   1298200000UL // in Hz
+#define INITIAL_SHIFT       -28000000L  // in Hz
 #define INITIAL_CTCSS       0           // in cHz
 #define INITIAL_MUTELEVEL   10          // scalar
-#define INITIAL_REFERENCE   13000UL     // in kHz
-#define CHANNELSTEP         25          // in kHz
-#define ONEMHZ              1000        // in kHz
-#define BANDBOTTOM          1240000UL   // in kHz
-#define BANDTOP             1300000UL   // in kHz
+#define INITIAL_REFERENCE   13000000UL  // in Hz
+#define INITIAL_RASTER      RS_25K      // channel raster
+#define ONEMHZ              1000000L    // in Hz
+#define PLLPRESCALER        16          // ADF4113 dual modulus prescaler 16/17
+#define BANDBOTTOM          1240000000UL // in Hz
+#define BANDTOP             1300000000UL // in Hz
 
 // }}}
 
 #define MEMCHANCOUNT        32          // number of memory channels to save
-#define IF                  69300UL     // in kHz
-#define INITIAL_FREQUENCY   1298200UL   // in kHz    
-#define INITIAL_SHIFT       -28000L     // in kHz
+#define MEMCHANEEPROM       256         // eeprom address of the memory channels
+
+#if (PERSISTENTCOUNT*4) > MEMCHANEEPROM
+#error "the menu values run into the memory channels in eeprom"
+#endif
+#define IF                  69300000UL  // in Hz
+#define INITIAL_FREQUENCY   1298200000UL // in Hz
+#define INITIAL_SHIFT       -28000000L  // in Hz
 #define INITIAL_CTCSS       0           // in cHz (centi Hertz)
 #define INITIAL_MUTELEVEL   10          // scalar
-#define INITIAL_REFERENCE   13000UL     // in kHz
-#define CHANNELSTEP         25          // in kHz
-#define LARGESTEP           1000        // in kHz
-#define BANDBOTTOM          1240000UL   // in kHz
-#define BANDTOP             1300000UL   // in kHz
+#define INITIAL_REFERENCE   13000000UL  // in Hz
+#define LARGESTEP           1000000L    // in Hz
+#define BANDBOTTOM          1240000000UL // in Hz
+#define BANDTOP             1300000000UL // in Hz
+
+// channel rasters, see RasterSteps[]. All frequencies are in Hz, because
+// the 12.5 kHz raster puts half kHz channels in the band.
+#define RS_25K              0
+#define RS_20K              1
+#define RS_12K5             2
+#define RS_MAX              RS_12K5
 
 #define DISPLAY_WIDTH       16
 #define DISPLAY_HEIGHT       2
 
+// S-meter levels are 2 dB each, level 0 is S0 (-147 dBm), S9 (-93 dBm) is
+// level 27, one S-unit is 3 levels. Display and squelch both use them.
+#define SMETERLEVEL(dbm)    (((dbm) + 147) / 2)
+#define SMETERMAXLEVEL      63
+#define SMETERTABLEBASE     768         // lowest ADC value in SMeterCurve[], lower shows the top level
+#define SMCALLOWDBM         -121        // calibration signal for MSMCALLOW, S5
+#define SMCALHIGHDBM        -81         // calibration signal for MSMCALHIGH, S9+12 dB
+
 #define MAXMUTELEVEL        32
-#define MINSHIFT            -60000L
-#define MAXSHIFT            60000L
+#define INITIAL_SQUELCHCLOSE 8          // scalar, at most the mute (open) level
+#define INITIAL_SQUELCHMINOPEN 0        // in cs
+#define INITIAL_SQUELCHTAIL 20          // in cs
+#define SQUELCHTIMESTEP     5           // in cs, per rotary step
+#define SQUELCHMAXTIME      500         // in cs
+#define INITIAL_SQUELCHAUTO FALSE       // boolean: open at the noise floor plus the margin
+#define INITIAL_SQUELCHMARGIN 8         // scalar, above the noise floor
+#define NOISEFLOORFRACTION  4           // fraction bits of SS_NoiseFloor
+#define NOISEFLOORDOWN      (1 << NOISEFLOORFRACTION) // per cs, signal below the floor
+#define NOISEFLOORUP        1           // per cs, signal above the floor, squelch closed
+#define NOISEFLOOROPENRATE  4           // while open the floor rises this many times slower,
+#define NOISEFLOORSTRONGRATE 64         // and this many for a level a margin above the open level
+#define MINSHIFT            -60000000L  // in Hz
+#define MAXSHIFT            60000000L   // in Hz
+#define MINREFERENCE        5000000UL   // in Hz, ADF4113HV Fref = 5 .. 150 MHz
+#define MAXREFERENCE        150000000UL // in Hz
 
 #define SM_NONE             0
 #define SM_STEP             1
@@ -140,20 +209,62 @@
 
 #define SELECTBOUNCEDELAY   1   // mainloop cycle time = 34 ms.
 
+#define SMETERPEAKHOLD    100   // centiseconds, 0 = no S-meter peak marker
+#define SMETERPEAKDECAY    10   // centiseconds per level once the hold time is over
+#define SMETERUNKNOWN    0xFF   // S-meter bar has to be redrawn completely
+
 #ifdef TESTING
 #define YTop        10
 #define XTop        21
 #define DBGROW      14
+#define TTYROWS     48      // size of the terminal screen model
+#define TTYCOLS     80
+#define TTYFRAMERATE 25     // max terminal updates per second
+#define SIMMAXPACE  100000  // us, never sleep longer than this to pace one loop pass
+#define SIMFASTFORWARD 10000 // ms of virtual time skipped by the 'f' key
+
+// modelled cost on the 1 MHz target in us, charged to the virtual clock
+#define SIMADCISR    40     // the ADC interrupt, once every ADCCONVERSION us
+#define SIMPLLWORD   200    // shifting out 24 bits and the latch pulse
+#define SIMPLLLOCK   600    // time the PLL needs to lock after a new word
+#define SIMEEPROMWRITE 13600 // 4 bytes of 3.4 ms
+#define SIMEEPROMREAD  20   // 4 bytes, eeprom_update_dword() with nothing to write
+#define SIMLCDBYTE   140    // lcdQueuePut() plus sending it from the timer 2 interrupt
+#define SIMINPUTCODE  150   // plain code of each handler, everything not charged otherwise
+#define SIMPROCCODE   400
+#define SIMOUTPUTCODE 300
+
+// where the modelled time goes
+#define ST_INIT      0      // stages
+#define ST_INPUT     1
+#define ST_PROCESS   2
+#define ST_OUTPUT    3
+#define SIMSTAGES    4
+#define SC_DELAY     0      // causes
+#define SC_ADC       1
+#define SC_PLL       2
+#define SC_EEPROM    3
+#define SC_LCD       4
+#define SC_CODE      5
+#define SIMCAUSES    6
+#define SIMSTAGE(s)  simEnterStage(s)
+#define SIMPLLBUS()  simPllBus()
+#define SIMADC()     simAdcService()
+#else
+#define SIMSTAGE(s)
+#define SIMPLLBUS()
+#define SIMADC()
 #endif
 
 // }}}
 // {{{ defines for ATMEGA328 
 #ifdef TESTING
-#define eeprom_write_dword(a,b) 
+#define eeprom_write_dword(a,b) simCharge(SC_EEPROM, SIMEEPROMWRITE)
+#define eeprom_write_block(p,a,n) simCharge(SC_EEPROM, SIMEEPROMWRITE*((n)/4))
 //      port-nr      pin-nr  function
 #define PB0 0       // (14) display - E
 #define PB1 1       // (15) display - RS
-#define PB2 2       // (16) not used
+#define PB2 2       // (16) display - R/W (only with LCD_BUSYFLAG)
 #define PB3 3       // (17) CTCSS - tone
 #define PB4 4       // (18) display - D4
 #define PB5 5       // (19) display - D5
@@ -174,7 +285,7 @@
 #define PD2 2       // (4)  input - Push / Select
 #define PD3 3       // (5)  input - Rotary Encoder Clock
 #define PD4 4       // (6)  input - Rotary Encoder Data
-#define PD5 5       // (11) not used
+#define PD5 5       // (11) input - PLL MUXOUT (lock detect)
 #define PD6 6       // (12) not used
 #define PD7 7       // (13) not used
 
@@ -206,11 +317,67 @@ typedef unsigned char u08;
 #define MUTE        PC4
 #define TXON        PC3
 
+// S-meter ADC (ADC5), free running: a conversion every 13 ADC clocks, each
+// one interrupts. 128 gives 600 conversions a second, a lower prescaler
+// converts faster but costs more interrupt time (roughly 40 cycles each).
+#define ADCPRESCALER  128   // 2, 4, 8 .. 128: ADC clock = F_CPU/ADCPRESCALER
+#define ADCPS         ((ADCPRESCALER>=128)?7:(ADCPRESCALER>=64)?6:(ADCPRESCALER>=32)?5: \
+                       (ADCPRESCALER>=16)?4:(ADCPRESCALER>=8)?3:(ADCPRESCALER>=4)?2:1)
+#define ADCCONVERSION (13UL*ADCPRESCALER*1000000UL/F_CPU)  // us per conversion
+#define ADCOVERSAMPLEBITS 4 // 2, 3 or 4: 4, 8 or 16 conversions per filter sample
+#define ADCOVERSAMPLE (1<<ADCOVERSAMPLEBITS)
+
+// S-meter filter, runs in the ADC interrupt once per ADCOVERSAMPLE
+// conversions (37.5 Hz with the defaults), so its response does not depend
+// on the main loop. level += (sample - level) >> shift, with the attack
+// shift for a rising signal (falling ADC value) and the decay shift for a
+// falling one. The time constant is about 2^shift filter samples:
+// 0 = none, 1 = 53 ms, 2 = 107 ms, 3 = 213 ms, 4 = 430 ms at 37.5 Hz.
+#define SMETERATTACK  1
+#define SMETERDECAY   3
+#define SMETERFRACTION 6    // fraction bits of the filter level, 10+6 bits fill a uint16_t
+
 // ADF4113
 #define ALE          PC2
 #define ADATA        PC1
 #define ACLK         PC0
 
+// ADF4113 latches, selected by the 2 low bits of each word
+#define PLL_R        0      // reference counter
+#define PLL_N        1      // A and B counters
+#define PLL_FUNC     2      // function latch
+#define PLL_INIT     3      // initialisation latch
+#define PLLLATCHES   4
+#define PLLFUNCTION  0x438092UL // 16/17 prescaler, normal counter operation, MUXOUT = lock detect
+#define PLLINITLATCH (PLLFUNCTION | PLL_INIT)
+
+// Uncomment to show the cycles one PLL word takes on the display at startup
+// #define PLL_BENCHMARK
+#define PLLBENCHRUNS 16     // PLL words timed by the benchmark
+#define PLLLOCKTIMEOUT 5000 // us to wait for lock after a new R or N word
+
+// Scanner dwell on each channel in cs: the lock wait, the conversion running
+// at lock (the filter starts over then) and SCANSETTLESAMPLES filter samples.
+// The first sample sets the level, the second one still moves a rising signal
+// half the way (SMETERATTACK 1), so a carrier on the open level is seen twice.
+#define SCANSETTLESAMPLES 2
+#define SCANSTEPDELAY ((PLLLOCKTIMEOUT + (SCANSETTLESAMPLES*ADCOVERSAMPLE+1)*ADCCONVERSION) / 10000 + 1)
+
+// ADF4113 fastlock: during a jump the charge pump runs on current setting 2
+// instead of setting 1 (3 bits each, 0 = lowest .. 7 = highest current).
+// PLLFUNCTION uses setting 1 = 7, which the loop filter on the board is
+// designed for. Fastlock only gains speed when setting 1 is lowered for a
+// narrower, lower noise loop, with the filter adapted to match.
+#define PLLCPFAST    7      // charge pump current setting 2, used during fastlock
+#define PLLCPGAIN    (1UL<<21)  // N latch: charge pump gain bit, starts fastlock
+#define PLLFASTLOCK  (1UL<<9)   // function latch: fastlock enable
+#define PLLFLTIMER   (1UL<<10)  // function latch: fastlock ends by the timeout counter
+#define FL_OFF       0      // SS_FastLock: no fastlock
+#define FL_SOFT      1      // fastlock until the lock detect says locked
+#define FL_TIMEOUT   2      // FL_TIMEOUT+n: fastlock for 3+4*n PFD cycles
+#define FL_MAX       (FL_TIMEOUT+15)
+#define PLLLOCKPOLL  10     // us between two looks at the lock detect pin
+
 
 // CTCSS & tone
 #define Beep        PB3
@@ -224,6 +391,7 @@ typedef unsigned char u08;
 #endif
 
 // rotary & switches
+#define PLL_LOCK    PD5     // ADF4113 MUXOUT, high when the loop is locked
 #define PTT         PD0
 #define SHIFTKEY    PD1
 #define SELECTKEY   PD2
@@ -240,6 +408,13 @@ typedef unsigned char u08;
 #define LCD_D4      PB4
 #define LCD_RS      PB1
 #define LCD_E       PB0
+#define LCD_RW      PB2
+
+// Uncomment when PB2 is wired to the R/W pin of the display. The driver then
+// polls the busy flag on D7 instead of waiting the worst case time.
+// #define LCD_BUSYFLAG
+#define LCDBUSYPOLLS   100  // give up waiting for the busy flag after this many reads
+#define LCDBURST         4  // max queue entries sent per tick in busy flag mode
 
 // LCD commands (HD44780)
 #define dispCLEAR   0x01
@@ -251,7 +426,43 @@ typedef unsigned char u08;
 #define dispCGRA    0x40 // <5 bit adr>                         (define custom chars)
 #define dispDDRA    0x80 // <6 bit adr>                         (cursor addresssing)
 
-// read status : RS=0, RW=0 bit 7 is busyflag
+// LCD transmit queue. Queueing a byte and sending it from the interrupt take
+// about 140 cycles (LCD_BENCHMARK shows the interrupt part), at 1 MHz a 1 ms
+// tick leaves the main loop, the CTCSS tone and the ADC more than 85% of the
+// time while the queue drains.
+// A full 32 cell flush still reaches the display within 40 ms.
+#define LCDQUEUESIZE    64  // entries, must be a power of 2
+#define LCDTICK       1000  // us between two queue entries sent to the display
+#define LCDSLOWTICKS  (1520/LCDTICK + 1) // ticks to wait after clear and home (> 1.52 ms)
+#if (F_CPU/8) * LCDTICK / 1000000UL > 256
+#error "LCDTICK does not fit the 8 bit timer 2 with the div/8 clock"
+#endif
+
+// Uncomment to show the cycles one LCD queue interrupt takes at startup
+// #define LCD_BENCHMARK
+#define LCDBENCHRUNS    16  // queue entries timed by the benchmark
+#define LQ_NIB          0   // single nibble, only used during initialisation
+#define LQ_CMD          1   // command byte
+#define LQ_DATA         2   // data byte
+#define LQ_WAIT         3   // value = number of ticks to wait
+
+// custom characters (CGRAM glyph ids)
+#define GL_BAR1         0   // S-meter cell with 1 line
+#define GL_BAR2         1   // S-meter cell with 2 lines
+#define GL_BAR3         2   // S-meter cell with 3 lines
+#define GL_PEAK         3   // S-meter peak marker
+#define GL_TX           4   // transmit icon
+#define GL_RX           5   // receive icon
+#ifdef TESTING
+#define GL_TEST         6   // 4 test glyphs from here, more glyphs than slots
+#define GLYPHCOUNT     10
+#else
+#define GLYPHCOUNT      6
+#endif
+#define GLYPHSLOTS      8   // the HD44780 has room for 8 custom characters
+#define GL_NONE      0xFF   // slot is empty
+
+// read status : RS=0, RW=1 bit 7 is busyflag
 // write data  : RS=1, RW=1 <8 bit data>
 // read  data  : RS=1, RW=0 <8 bit data>
 // }}}
@@ -259,9 +470,67 @@ typedef unsigned char u08;
 
 #ifdef TESTING
 
-unsigned char _BV(unsigned char c) { return c; }
-void _delay_us(short s) {} 
-void _delay_ms(short s) {} 
+// a real bit mask, so sbi/cbi/tbi change the port bits like on the target
+unsigned char _BV(unsigned char c) { return 1<<c; }
+#define PROGMEM
+#define pgm_read_byte(p) (*(p))
+#define pgm_read_dword(p) (*(p))
+#define ATOMIC_BLOCK(type)      // single threaded: a plain block
+
+// Virtual time in us. It only moves when the simulator says so: a delay
+// costs its length, every main loop pass costs SIMLOOPTIME. This makes all
+// timing (fast tune, tune save, scanner) repeatable from run to run.
+uint64_t simMicros = 0;
+
+// The same time is booked per stage and cause, see simReport()
+uint8_t  simStage = ST_INIT;
+uint64_t simCost[SIMSTAGES][SIMCAUSES];
+uint64_t simLoopStart;              // virtual time at the start of this loop pass
+uint64_t simPttTime;                // virtual time the PTT key went down or up, 0 = none pending
+uint32_t pttLatency;                // last PTT key to PLL latch time in us
+uint32_t pttLatencyMax;
+uint32_t pllWrites;                 // words shifted into the PLL
+uint32_t simLcdCmds;                // commands sent to the display, the other SC_LCD bytes are data
+uint64_t simPllLockAt;              // virtual time the PLL locks on the last word
+char     simPllFault;               // boolean: the PLL never locks ('u' key)
+
+// what an ADF4113 on the port C pins would have received, see simPllBus()
+struct SimPllBusStruct
+{
+    uint32_t shift;                 // the 24 bit input shift register
+    uint8_t  bits;                  // clock edges since the last latch pulse
+    uint8_t  prevPins;              // ACLK and ALE at the previous look
+    uint32_t latch[PLLLATCHES];     // decoded latches, indexed by PLL_R .. PLL_INIT
+    uint32_t updates;               // latch pulses
+    uint32_t clocks;                // clock edges, one bus bit-time each
+    uint32_t badUpdates;            // latch pulses after other than 24 bits
+    uint8_t  nPins;                 // TXON and MUTE at the last N latch pulse
+} simBus;
+const uint16_t SimStageCode[SIMSTAGES] = { 0, SIMINPUTCODE, SIMPROCCODE, SIMOUTPUTCODE };
+
+void simAdvance(uint32_t us) { simMicros += us; }
+void simCharge(uint8_t cause, uint32_t us) { simCost[simStage][cause] += us; simAdvance(us); }
+
+void simEnterStage(uint8_t stage)
+{
+    // initialize() is not part of the first loop pass
+    if (simStage == ST_INIT)
+        simLoopStart = simMicros;
+    simStage = stage;
+    simCharge(SC_CODE, SimStageCode[stage]);
+}
+
+void simAdcService(void);   // see S-meter ADC
+
+// Inputs set directly by the test code instead of InputHandler(): only
+// charge what reading them would have cost, and the ADC interrupts
+void simHeldInputs(void)
+{
+    simEnterStage(ST_INPUT);
+    simAdcService();
+}
+void _delay_us(short s) { simCharge(SC_DELAY, s); }
+void _delay_ms(short s) { simCharge(SC_DELAY, s*1000UL); }
 
 #endif
 
@@ -278,18 +547,62 @@ void lcdStr16(char *s);
 void lcdCmd(char c);
 void lcdData(char c);
 void lcdHome(void);
-void lcdNib(char);
+static inline void lcdNib(char);
+void lcdQueuePut(uint8_t type, uint8_t value);
+void lcdQueueFlush(void);
+char lcdBusy(void);
+void lcdWaitReady(void);
 void lcdCursorPosition(int row, int col);
 
+void lcdFrameInit(void);
+void lcdFramePut(uint8_t row, uint8_t col, char c);
+void lcdFrameStr(uint8_t row, char *s);
+void lcdFlush(void);
+void lcdGlyphInit(void);
+char lcdGlyph(uint8_t id);
+
+char *fmtText(char *dst, char *s, uint8_t width);
+char *fmtNumber(char *dst, int32_t value, uint8_t width, uint8_t decimals);
+
 void OutputSetPLL(int32_t c);
-void OutputSetVfoFrequency(int32_t SS_VfoFrequency);
+void OutputSetVfoWord(char tx);
+uint32_t PllFunctionWord(int8_t fastlock);
+void OutputPllSettle(void);
+void OutputSetPLLReference(int32_t reference);
+void PllSet(uint8_t latch, uint32_t word);
+char PllLocked(void);
+char PllWaitLock(uint16_t timeout);
+#ifdef PLL_BENCHMARK
+void PllBenchmark(void);
+#endif
+#ifdef LCD_BENCHMARK
+void LcdBenchmark(void);
+#endif
+void PllCommit(void);
+struct PllCounterStruct;
+void PllCounterSet(struct PllCounterStruct *c, int32_t freq);
+void PllCounterAdd(struct PllCounterStruct *c, int8_t b, int8_t a);
+void PllCounterTrack(struct PllCounterStruct *c, int32_t freq);
 void OutputSetTransmitterOn(char boolean);
 
 void WritePersistent(int index);
 int32_t ReadPersistent(int index);
+int32_t PersistentHz(uint8_t ix, int32_t low, int32_t high);
+void ProcSetRaster(int8_t raster);
+void SMeterCalibrate(void);
+char ProcNextMemoryChannel(void);
+void ProcLeaveMemoryChannel(void);
+int8_t CtcssIndexOf(uint16_t tone);
 
 #ifdef TESTING
 void initPersistentStorage(void);
+void ProcessingHandler(void);
+void OutputHandler(void);
+void simLoopDone(void);
+void simFastForward(uint32_t ms);
+void simReport(FILE *f);
+void simPllBus(void);
+uint32_t simPllVco(uint32_t reference);
 #endif
 // }}}
 // {{{ Datastructure definitions
@@ -300,6 +613,9 @@ void initPersistentStorage(void);
 // level definitions
 #define ML_MAIN 0
 #define ML_SUB1 1
+#define ML_SUB2 2
+#define ML_SUB3 3
+#define ML_SUB4 4
 
 // datatype defintions
 #define MD_NONE 0
@@ -315,35 +631,56 @@ struct MenuInfoStruct
     uint8_t length;
 };
 
+// how to print a value: right aligned number in a field of "width"
+// characters, with "decimals" digits behind the decimal point, followed by "unit"
+struct FormatStruct
+{
+    uint8_t width;
+    uint8_t decimals;
+    char    *unit;
+};
+
 struct MenuStruct
 {
     char    *name;
     uint8_t level;
     uint8_t position;
     uint8_t datatype;
-    char    *format;
+    struct  FormatStruct format;
     int32_t value;
 };
 
 struct MemoryChannelStruct
 {
-    int32_t  frequency;     // the frequency of this channel
+    int32_t  frequency;     // the frequency of this channel, 0 when not programmed
     int32_t  shift;         // repeater shift (if any) with this channel
     uint32_t ctcss;         // CTCSS frequency for this repeater (if any) 
 };
 
+// ADF4113 N counter: channel = vfo/SS_ChannelStep = 16*b + a (16/17 prescaler)
+struct PllCounterStruct
+{
+    int32_t  freq;          // the vfo frequency (Hz) the counters are set for
+    uint16_t b;             // B counter, 13 bit
+    int8_t   a;             // A counter, 0..15
+    uint32_t reg;           // the N register word for these counters
+};
+
 // }}}
 // {{{ Constants
 
-// If an extra submenu would be introduced, then you would need to add the following record:
-// { ML_SUB2, <index_of_first_entry>, <index_of_last_entry>, <nr_of_entries> }
-// and off course we need: #define ML_SUB2  2
+// An extra submenu needs a record like the following:
+// { ML_SUB5, <index_of_first_entry>, <index_of_last_entry>, <nr_of_entries> }
+// and off course we need: #define ML_SUB5  5
 
 const struct MenuInfoStruct infoMenu[] = 
 {
     //    level    start     end          nr of entries (length)
     { ML_MAIN, MAINMENU, MBACK2TUNE , MBACK2TUNE-MAINMENU + 1 },
-    { ML_SUB1, SUBMENU1, MABACK2MAIN, MABACK2MAIN-SUBMENU1 + 1 }    // for now, skip factory reset
+    { ML_SUB1, SUBMENU1, MABACK2MAIN, MABACK2MAIN-SUBMENU1 + 1 },   // for now, skip factory reset
+    { ML_SUB2, SUBMENU2, MSQBACK2MAIN, MSQBACK2MAIN-SUBMENU2 + 1 },
+    { ML_SUB3, SUBMENU3, MSMBACK2SET, MSMBACK2SET-SUBMENU3 + 1 },
+    { ML_SUB4, SUBMENU4, MSCBACK2MAIN, MSCBACK2MAIN-SUBMENU4 + 1 }
 };
 
 // formula for next menu item to display
@@ -353,43 +690,88 @@ const struct MenuInfoStruct infoMenu[] =
 
 struct MenuStruct theMenu[] = 
 {
-    { "Mute Level"    , ML_MAIN, 0, MD_INT , "%s%2d"           , INITIAL_MUTELEVEL   },    // 00
-#ifdef TESTING
-    { "Shift"         , ML_MAIN, 1, MD_INT , "%s%4d.%03u MHz"  , INITIAL_SHIFT       },    // 01
-    { "CTCSS"         , ML_MAIN, 2, MD_INT , "%s%3u.%1u Hz"    , INITIAL_CTCSS       },    // 02
-    { "Scan Start"    , ML_MAIN, 3, MD_INT , "%s%4u.%03u MHz"  , BANDBOTTOM          },    // 03
-    { "Scan End"      , ML_MAIN, 4, MD_INT , "%s%4u.%03u MHz"  , BANDTOP             },    // 04
-#else
-    { "Shift"         , ML_MAIN, 1, MD_INT , "%s%4ld.%03lu MHz", INITIAL_SHIFT       },    // 01
-    { "CTCSS"         , ML_MAIN, 2, MD_INT , "%s%3u.%1u Hz"    , INITIAL_CTCSS       },    // 02
-    { "Scan Start"    , ML_MAIN, 3, MD_INT , "%s%4lu.%03lu MHz", BANDBOTTOM          },    // 03
-    { "Scan End"      , ML_MAIN, 4, MD_INT , "%s%4lu.%03lu MHz", BANDTOP             },    // 04
-#endif
-    { "Start Scanning", ML_MAIN, 5, MD_NONE, ""                , 0                   },    // 05 "value" unused
-    { "Settings"      , ML_MAIN, 6, MD_NONE, ""                , 0                   },    // 06 "value" unused
-    { "Back to tune"  , ML_MAIN, 7, MD_NONE, ""                , 0                   },    // 07 "value" unused
-    { "On select go"  , ML_SUB1, 0, MD_BOOL, "%s%s"            , TRUE                },    // 08
+    { "Mute Level"    , ML_MAIN, 0, MD_INT , { 2, 0, ""     }, INITIAL_MUTELEVEL   },    // 00
+    { "Shift"         , ML_MAIN, 1, MD_INT , { 8, 6, " MHz" }, INITIAL_SHIFT       },    // 01
+    { "CTCSS"         , ML_MAIN, 2, MD_INT , { 5, 1, " Hz"  }, INITIAL_CTCSS       },    // 02
+    { "Scan Start"    , ML_MAIN, 3, MD_INT , { 8, 6, " MHz" }, BANDBOTTOM          },    // 03
+    { "Scan End"      , ML_MAIN, 4, MD_INT , { 8, 6, " MHz" }, BANDTOP             },    // 04
+    { "Scanning"      , ML_MAIN, 5, MD_NONE, { 0, 0, ""     }, 0                   },    // 05 "value" unused
+    { "Settings"      , ML_MAIN, 6, MD_NONE, { 0, 0, ""     }, 0                   },    // 06 "value" unused
+    { "Back to tune"  , ML_MAIN, 7, MD_NONE, { 0, 0, ""     }, 0                   },    // 07 "value" unused
+    { "On select go"  , ML_SUB1, 0, MD_BOOL, { 0, 0, ""     }, TRUE                },    // 08
+    { "PLL Ref MHz"   , ML_SUB1, 1, MD_INT , { 8, 6, " MHz" }, INITIAL_REFERENCE   },    // 09
+    { "PLL Ref kHz"   , ML_SUB1, 2, MD_INT , { 8, 6, " MHz" }, INITIAL_REFERENCE   },    // 10
+    { "Baudrate"      , ML_SUB1, 3, MD_INT , { 6, 0, ""     }, 9600                },    // 11
+    { "Rotary type"   , ML_SUB1, 4, MD_BOOL, { 0, 0, ""     }, FALSE               },    // 12
+    { "Remote enable" , ML_SUB1, 5, MD_BOOL, { 0, 0, ""     }, FALSE               },    // 13
+    { "Front enable"  , ML_SUB1, 6, MD_BOOL, { 0, 0, ""     }, TRUE                },    // 14
+    { "PLL Fastlock"  , ML_SUB1, 7, MD_INT , { 2, 0, " PFD cycles" }, FL_OFF       },    // 15
+    { "Channel raster", ML_SUB1, 8, MD_INT , { 0, 0, ""     }, INITIAL_RASTER      },    // 16
+    { "S-meter calib" , ML_SUB1, 9, MD_NONE, { 0, 0, ""     }, 0                   },    // 17 "value" unused
+    { "Back to main"  , ML_SUB1,10, MD_NONE, { 0, 0, ""     }, 0                   },    // 18 "value" unused
+    { "Factory reset" , ML_SUB1,11, MD_NONE, { 0, 0, ""     }, 0                   },    // 19 "value" unused
+    { "Open level"    , ML_SUB2, 0, MD_INT , { 2, 0, ""     }, INITIAL_MUTELEVEL   },    // 20 copy of 00
+    { "Close level"   , ML_SUB2, 1, MD_INT , { 2, 0, ""     }, INITIAL_SQUELCHCLOSE},    // 21
+    { "Min open time" , ML_SUB2, 2, MD_INT , { 4, 2, " s"   }, INITIAL_SQUELCHMINOPEN }, // 22
+    { "Squelch tail"  , ML_SUB2, 3, MD_INT , { 4, 2, " s"   }, INITIAL_SQUELCHTAIL },    // 23
+    { "Squelch mode"  , ML_SUB2, 4, MD_BOOL, { 0, 0, ""     }, INITIAL_SQUELCHAUTO },    // 24
+    { "Auto margin"   , ML_SUB2, 5, MD_INT , { 2, 0, ""     }, INITIAL_SQUELCHMARGIN },  // 25
+    { "Back to main"  , ML_SUB2, 6, MD_NONE, { 0, 0, ""     }, 0                   },    // 26 "value" unused
+    { "Cal -121 dBm"  , ML_SUB3, 0, MD_INT , { 4, 0, " ADC" }, 0                   },    // 27 0: not calibrated
+    { "Cal -81 dBm"   , ML_SUB3, 1, MD_INT , { 4, 0, " ADC" }, 0                   },    // 28 0: not calibrated
+    { "Back to setup" , ML_SUB3, 2, MD_NONE, { 0, 0, ""     }, 0                   },    // 29 "value" unused
+    { "Scan band"     , ML_SUB4, 0, MD_NONE, { 0, 0, ""     }, 0                   },    // 30 "value" unused
+    { "Scan memories" , ML_SUB4, 1, MD_NONE, { 0, 0, ""     }, 0                   },    // 31 "value" unused
+    { "Save channel"  , ML_SUB4, 2, MD_INT , { 2, 0, ""     }, 1                   },    // 32 channel number, not stored
+    { "Back to main"  , ML_SUB4, 3, MD_NONE, { 0, 0, ""     }, 0                   },    // 33 "value" unused
+};
+
+// custom characters, loaded into CGRAM on demand by lcdGlyph()
+const unsigned char Glyphs[GLYPHCOUNT][8] PROGMEM = {
+    {0b00000,0b00000,0b10000,0b10000,0b10000,0b10000,0b00000,0b00000},  // GL_BAR1
+    {0b00000,0b00000,0b10100,0b10100,0b10100,0b10100,0b00000,0b00000},  // GL_BAR2
+    {0b00000,0b00000,0b10101,0b10101,0b10101,0b10101,0b00000,0b00000},  // GL_BAR3
+    {0b00000,0b00100,0b00100,0b00100,0b00100,0b00100,0b00100,0b00000},  // GL_PEAK
+    {0b00100,0b01110,0b10101,0b00100,0b00100,0b00100,0b00100,0b00000},  // GL_TX
+    {0b00100,0b00100,0b00100,0b00100,0b10101,0b01110,0b00100,0b00000},  // GL_RX
 #ifdef TESTING
-    { "PLL Ref MHz"   , ML_SUB1, 1, MD_INT , "%s%4u.%03u MHz"  , INITIAL_REFERENCE   },    // 09
-    { "PLL Ref kHz"   , ML_SUB1, 2, MD_INT , "%s%4u.%03u MHz"  , INITIAL_REFERENCE   },    // 10
-    { "Baudrate"      , ML_SUB1, 3, MD_INT , "%s%6d"           , 9600                },    // 11
-#else
-    { "PLL Ref MHz"   , ML_SUB1, 1, MD_INT , "%s%4lu.%03lu MHz", INITIAL_REFERENCE   },    // 09
-    { "PLL Ref kHz"   , ML_SUB1, 2, MD_INT , "%s%4lu.%03lu MHz", INITIAL_REFERENCE   },    // 10
-    { "Baudrate"      , ML_SUB1, 3, MD_INT , "%s%6ld"          , 9600                },    // 11
-#endif
-    { "Rotary type"   , ML_SUB1, 4, MD_BOOL, "%s%s"            , FALSE               },    // 13
-    { "Remote enable" , ML_SUB1, 5, MD_BOOL, "%s%s"            , FALSE               },    // 14
-    { "Front enable"  , ML_SUB1, 6, MD_BOOL, "%s%s"            , TRUE                },    // 15
-    { "Back to main"  , ML_SUB1, 7, MD_NONE, ""                , 0                   },    // 16 "value" unused
-    { "Factory reset" , ML_SUB1, 8, MD_NONE, "%s%s"            , 0                   },    // 17 "value" unused
+    {0b00000,0b00000,0b00000,0b00100,0b00000,0b00000,0b00000,0b00000},  // GL_TEST
+    {0b00000,0b00000,0b01000,0b00000,0b00010,0b00000,0b00000,0b00000},
+    {0b00000,0b00000,0b01000,0b00100,0b00010,0b00000,0b00000,0b00000},
+    {0b00000,0b00000,0b01010,0b00000,0b01010,0b00000,0b00000,0b00000},
+#endif
 };
 
-// define S-meter chars
-const unsigned char smeter[3][8] = {
-    {0b00000,0b00000,0b10000,0b10000,0b10000,0b10000,0b00000,0b00000},
-    {0b00000,0b00000,0b10100,0b10100,0b10100,0b10100,0b00000,0b00000},
-    {0b00000,0b00000,0b10101,0b10101,0b10101,0b10101,0b00000,0b00000}
+// S-meter level (see SMETERLEVEL) of the filtered ADC value, from ADC
+// SMETERTABLEBASE up. This is the uncalibrated detector curve, a straight
+// 2 ADC steps per level from no signal at 980; replace it with a measured
+// curve for a detector that is not linear in dB. SMeterCalibrate() fits
+// it to the two calibration points.
+const uint8_t SMeterCurve[1024-SMETERTABLEBASE] PROGMEM = {
+    63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,  //  768
+    63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,  //  784
+    63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,  //  800
+    63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,  //  816
+    63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,  //  832
+    63,63,63,63,63,63,63,62,62,61,61,60,60,59,59,58,  //  848
+    58,57,57,56,56,55,55,54,54,53,53,52,52,51,51,50,  //  864
+    50,49,49,48,48,47,47,46,46,45,45,44,44,43,43,42,  //  880
+    42,41,41,40,40,39,39,38,38,37,37,36,36,35,35,34,  //  896
+    34,33,33,32,32,31,31,30,30,29,29,28,28,27,27,26,  //  912
+    26,25,25,24,24,23,23,22,22,21,21,20,20,19,19,18,  //  928
+    18,17,17,16,16,15,15,14,14,13,13,12,12,11,11,10,  //  944
+    10, 9, 9, 8, 8, 7, 7, 6, 6, 5, 5, 4, 4, 3, 3, 2,  //  960
+     2, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  //  976
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  //  992
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0   // 1008
+};
+
+// plain character to show when a glyph can not be loaded, the simulator
+// also uses these to show the custom characters
+const char GlyphText[GLYPHCOUNT] = { '.', '\'', '"', '|', 'T', 'R',
+#ifdef TESTING
+    '1', '2', '3', '4',
+#endif
 };
 
 //CTCSS frequencies
@@ -399,13 +781,22 @@ const uint16_t CtcssTones[] = {   0, 670, 689, 693, 710, 719, 744, 770, 797, 825
     2107,2181,2257,2291,2336,2418,2503,2541, -1
 };
 
+// used for digit extraction by subtraction, see fmtNumber()
+const uint32_t PowersOfTen[] PROGMEM = { 1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+    10000UL, 1000UL, 100UL, 10UL, 1UL };
+
 // uint8_t ctcssIndex;
 const uint8_t ctcssLength = (sizeof(CtcssTones)/sizeof(uint16_t))-2;
 
 uint32_t Baudrates[] = { 1200, 2400, 4800, 9600, 19200, 38400, 76800, 115600 };
 uint8_t baudrateLength = 8 - 1;
 
+// channel step per raster, indexed by RS_25K .. RS_12K5
+const int32_t RasterSteps[] = { 25000, 20000, 12500 };     // in Hz
+char *RasterNames[] = { "25 kHz", "20 kHz", "12.5 kHz" };
+
 const uint32_t ScanResumeDelay=1000;         // how long before started scanning on a mute channel
+const uint16_t ScanStepDelay=SCANSTEPDELAY;  // time on a locked channel before the next step, lets the squelch settle
 
 // }}} /end constants
 // {{{ Globals
@@ -416,15 +807,21 @@ const uint32_t ScanResumeDelay=1000;         // how long before started scanning
 volatile int        IRQ_RotaryChange;   // amount of steps to take 
 volatile char       IRQ_SelectorPushed; // boolean: Pushed = true; Idle = false;
 volatile uint32_t   IRQ_Ticks;          // one timer tick roughly every 10 ms.
+volatile uint16_t   IRQ_SMeter;         // latest filtered S-meter value, in ADC steps
+volatile char       IRQ_SquelchOpen;    // boolean: opened by the ADC interrupt, cleared on closing
+volatile char       IRQ_Carrier;        // boolean: the squelch opened, cleared by ProcScanner()
+volatile char       IRQ_Retuning;       // boolean: a new N word is not locked yet, the ADC interrupt waits
+volatile char       IRQ_SMeterValid;    // boolean: IRQ_SMeter is a filter sample of the current channel
 
 int         SS_RotaryCount;
 int         SS_RotaryType;              // int: 0=click per cycle (classic), 1=click per pulse
 char        SS_Tuning;                  // boolean: tuning = true, in menu = false
 char        SS_FastTune;                // boolean: tune steps per MHz when true
-char        SS_MemoryChannel;           // boolean: step through the memory channels when true;
+char        SS_MemoryChannel;           // boolean: a memory channel's shift and tone are in use, the VFO's are saved
 char        SS_Transmitting;            // boolean: TX = true, RX = false;
 char        SS_Scanning;                // boolean: scanning = true;
-char        SS_ScanMode;                // int: 0 = not scanning, 1 =
+char        SS_ScanMode;                // int: SM_NONE, SM_STEP (the band) or SM_CHANNEL (memory channels)
+int8_t      SS_MemoryIndex;             // memory channel the channel scan is on
 char        SS_Muted;                   // boolean: TRUE=audio muted, FALSE=audio on 
 char        SS_ShiftChange;             // int: 0 = no change, 1 = actived, 2 = deactivated
 char        SS_ShiftEnable;             // boolean: shifted = true;
@@ -432,22 +829,37 @@ char        SS_ReverseShift;            // boolean: swap transmit and receive fr
 uint32_t    SS_CtcssFrequency;          // the tone value to inject
 int8_t      SS_CtcssIndex;            
 int8_t      SS_BaudrateIndex;            
+int8_t      SS_FastLock;                // FL_OFF, FL_SOFT or FL_TIMEOUT + timeout counter value
+int8_t      SS_Raster;                  // RS_25K, RS_20K or RS_12K5
+int32_t     SS_ChannelStep;             // in Hz, the step of SS_Raster, set by ProcSetRaster()
 uint32_t    SS_Baudrate;
 int         SS_MenuState;               // state of the current user input menu
 int         SS_MenuIndex;               // position in the value lists
 char        SS_MuteIndicator;           // marker to display when audio is muted
-int8_t      SS_MuteLevel;               // level below which the audio will be muted
+int8_t      SS_MuteLevel;               // level at which the squelch opens
+int8_t      SS_SquelchClose;            // level below which the squelch closes again
+uint16_t    SS_SquelchMinOpen;          // in cs, shortest time the squelch stays open
+uint16_t    SS_SquelchTail;             // in cs, time the squelch stays open after the signal is gone
+char        SS_SquelchAuto;             // boolean: the open level follows the noise floor
+int8_t      SS_SquelchMargin;           // auto squelch opens this far above the noise floor
+uint16_t    SS_NoiseFloor;              // S-meter noise level, NOISEFLOORFRACTION fraction bits
+int16_t     SS_OpenLevel;               // open level in use, also read by the ADC interrupt
+int16_t     SS_SMeterGain;              // S-meter calibration: gain in 1/256
+int16_t     SS_SMeterOffset;            // S-meter calibration: offset in levels
 int32_t     SS_FrequencyShift;          // shift value to use during repeater shift
 int32_t     SS_BaseFrequency;           // tuned with the rotary dial. All freqs are derived from this var.
 int32_t     SS_VfoFrequency;            // the frequency to VFO must be tuned to 
 int32_t     SS_DisplayFrequency;        // frequency to show on display
 int16_t     SS_DisplaySMeter;           // value to show on display
 int16_t     SS_SMeterIn;                // value read from the s-meter ADC
+char        SS_SMeterValid;             // boolean: SS_SMeterIn is a reading, not the retune placeholder
 
 char        SS_Selected;
 char        SS_PTT;
 char        SS_TxRxIndicator;
 char        SS_TuneIndicator;           // boolean: shows when we are in large step (fast) tuning mode
+char        SS_PllLocked;               // boolean: PLL lock detect after the last settle wait
+uint16_t    SS_PllUnlocks;              // times the PLL did not lock in time or lost lock
 int32_t     SS_ScanStartFrequency;      // duh...
 int32_t     SS_ScanEndFrequency;        // duh...
 
@@ -460,18 +872,24 @@ uint32_t    SS_PllReferenceFrequency;   // frequency that is used as PLL referen
 char  SS_ValueEdit;
 
 struct MemoryChannelStruct memory[MEMCHANCOUNT];
+char    vfoShiftEnable;                 // the VFO settings while SS_MemoryChannel
+int32_t vfoFrequencyShift;
+int8_t  vfoCtcssIndex;
 
 // }}}  System State variables
 
 #ifdef TESTING
 char  tmpFreqChanged=FALSE;
 char  tmpFreqSaved=FALSE;
+int32_t  simSavedFrequency;  // eeprom slot 5, to charge only real writes
+uint32_t simFrequencySaves;  // number of times slot 5 was written
 char  AutoTest=FALSE;        // set to true via commandline when automated testing is in order
 char  dbg_logging=FALSE;     // set to true via commandline when we need debug logging
+char  Headless=FALSE;        // set to true via commandline: no terminal i/o, run the tests at full speed
 short goingUp;               // tmp global
 short LoopCounter;           // tmp global
 short cpos;                  // display: lineair cursor position
-int   simuls;                // simulated S-meter value
+int   simuls = 980;          // simulated S-meter value, starts without signal
 #endif
 
 uint32_t channelCloseTime;   // when larger then scan-resume-delay, resume the scanning action.
@@ -483,19 +901,53 @@ uint16_t TimerValue;         // value to program in the timer
 
 char GClkPrev;               // used for rotary dial handling
 
-uint16_t LowPass;            // Variable for S-meter lowpass filter
+uint8_t  SMeterLevel = SMETERUNKNOWN; // level of the S-meter bar on the display
+uint8_t  SMeterPeakLevel;    // level of the peak marker on the display
 char  IntRotLines;           // remember status of rotary switch inputs
 
 int32_t prevFreq;            // used to determine if the freq display needs updating
+struct PllCounterStruct pllRx;  // N counter for receive, kept up to date by ProcFrequencyCalculator()
+struct PllCounterStruct pllTx;  // N counter for transmit
+
+// ADF4113 shadow registers, indexed by latch (PLL_R .. PLL_INIT)
+// pllShadow : what the output routines want the PLL to hold
+// pllChip   : what has been shifted into the PLL, 0 = never written
+uint32_t pllShadow[PLLLATCHES];
+uint32_t pllChip[PLLLATCHES];
+char     pllSettling;        // boolean: a new R or N word was sent, wait for lock before using it
+int32_t  pllNFreq;           // vfo frequency of the last N word set
+int8_t   pllMHzB;            // one MHz in N counter steps for the current raster,
+int8_t   pllMHzA;            // b*PLLPRESCALER + a channels, set by ProcSetRaster()
 
 char  LineT[DISPLAY_WIDTH+5]; // top display line + 5 bytes reserve
 char  LineB[DISPLAY_WIDTH+5]; // bottom display line
 
+// shadow copies of the display data ram (DDRAM)
+// lcdFrame : what the output routines want to show
+// lcdDdram : what the display controller currently shows
+char  lcdFrame[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+char  lcdDdram[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+
+// CGRAM glyph cache
+uint8_t  glyphSlot[GLYPHSLOTS]; // glyph id held by each CGRAM slot
+uint16_t glyphUsed[GLYPHSLOTS]; // glyphClock value of the last use of the slot
+uint16_t glyphClock;            // counts lcdGlyph() calls
+uint16_t glyphLoads;            // statistics: CGRAM uploads
+uint16_t glyphHits;             // statistics: glyph was already resident
+
 #ifdef TESTING
 // short  theMainEvent;
 char   GetcBuffer;
 short  GetcAvail;
 struct termios orig_termios;
+char   deCgram;             // display emulator: data goes to the character generator
+char   ttyScreen[TTYROWS][TTYCOLS];        // terminal screen model
+char   ttyScreenColor[TTYROWS][TTYCOLS];
+char   ttyShown[TTYROWS][TTYCOLS];         // what the terminal shows now
+char   ttyShownColor[TTYROWS][TTYCOLS];
+short  ttyRow, ttyCol;      // cursor in the screen model
+short  ttyMaxRow;           // lowest row written
+char   ttyColor;            // ansi color code used for new characters, 0 = default
 FILE   *dbg;
 FILE   *eeprom;
 #endif
@@ -616,6 +1068,124 @@ ISR(TIMER1_OVF_vect)
     }
 } 
 
+#endif
+// }}}
+// {{{ S-meter ADC
+
+// S-meter level of the filtered ADC value: a lookup in the detector curve,
+// then the two point calibration (see SMeterCalibrate()). The ADC interrupt
+// uses it for every filter sample, so keep it short.
+
+static inline int16_t SMeterNominal(uint16_t adc)
+{
+    return (adc < SMETERTABLEBASE) ? SMETERMAXLEVEL : pgm_read_byte(&SMeterCurve[adc - SMETERTABLEBASE]);
+}
+
+// A calibration point has to be on the slope of the curve: on one of its
+// flat ends the nominal level is clamped and the fit would be off.
+
+static inline char SMeterOnSlope(uint16_t adc)
+{
+    int16_t level = SMeterNominal(adc);
+
+    return (level > 0) && (level < SMETERMAXLEVEL);
+}
+
+static inline int16_t SMeterScale(uint16_t adc)
+{
+    int16_t level;
+
+    level = (((int32_t)SMeterNominal(adc) * SS_SMeterGain) >> 8) + SS_SMeterOffset;
+    if (level < 0)              level = 0;
+    if (level > SMETERMAXLEVEL) level = SMETERMAXLEVEL;
+    return level;
+}
+
+// Straight line through the two calibration points: the ADC values
+// recorded with SMCALLOWDBM and SMCALHIGHDBM at the antenna. Without both
+// points (0 in eeprom), or with one off the slope, the curve is used as it is.
+
+void SMeterCalibrate(void)
+{
+    int32_t adcLow  = theMenu[MSMCALLOW].value;
+    int32_t adcHigh = theMenu[MSMCALHIGH].value;
+    int16_t low, high;
+    int16_t gain   = 256;
+    int16_t offset = 0;
+
+    if (SMeterOnSlope(adcLow) && SMeterOnSlope(adcHigh))
+    {
+        low  = SMeterNominal(adcLow);
+        high = SMeterNominal(adcHigh);
+        if (high > low)
+        {
+            gain   = ((int32_t)(SMETERLEVEL(SMCALHIGHDBM) - SMETERLEVEL(SMCALLOWDBM)) << 8) / (high - low);
+            offset = SMETERLEVEL(SMCALLOWDBM) - (((int32_t)low * gain) >> 8);
+        }
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        SS_SMeterGain   = gain;
+        SS_SMeterOffset = offset;
+    }
+}
+
+// ADC5 converts all the time (free running). Every result is added up,
+// the sum of ADCOVERSAMPLE conversions is one filter sample, scaled to
+// SMETERFRACTION fraction bits (oversampling 16 times gives 2 real ones).
+// The filter level starts at no signal. While retuning (IRQ_Retuning, from
+// the new N word until lock) conversions are dropped, after lock the next
+// filter sample sets the level directly, so the old channel does not linger
+// in the filter for a scan dwell. The simulator feeds the same code from
+// simAdcService().
+// Each filter sample also checks the open level in use: an opening unmutes at
+// once (not while transmitting) and raises IRQ_Carrier, so the scanner
+// stops on a signal it did not see in the main loop. Closing, with its
+// hysteresis and timers, is left to ProcSMeterSquelch(), which clears
+// IRQ_SquelchOpen when it mutes again.
+
+static inline void AdcAccumulate(uint16_t sample)
+{
+    static uint16_t sum;
+    static uint8_t  count;
+    static uint16_t level = 1023U << SMETERFRACTION;
+    static char     restart;
+    int32_t diff;
+
+    if (IRQ_Retuning)
+    {
+        restart = TRUE;
+        sum   = 0;
+        count = 0;
+        return;
+    }
+    sum += sample;
+    if (++count == ADCOVERSAMPLE)
+    {
+        diff = ((int32_t)sum << (SMETERFRACTION - ADCOVERSAMPLEBITS)) - level;
+        level += (restart) ? diff : diff >> ((diff < 0) ? SMETERATTACK : SMETERDECAY);
+        restart = FALSE;
+        IRQ_SMeter = ((uint32_t)level + (1U << (SMETERFRACTION-1))) >> SMETERFRACTION;
+        IRQ_SMeterValid = TRUE;
+        sum   = 0;
+        count = 0;
+
+        if (!SS_Transmitting && !IRQ_SquelchOpen && (SMeterScale(IRQ_SMeter) >= SS_OpenLevel))
+        {
+            IRQ_SquelchOpen = TRUE;
+            IRQ_Carrier = TRUE;
+            cbi(PORTC, MUTE);
+        }
+    }
+}
+
+#ifndef TESTING
+
+ISR(ADC_vect)
+{
+    AdcAccumulate(ADC);
+}
+
 #endif
 // }}}
 
@@ -664,11 +1234,20 @@ void initIRQ(void)
     // Setup Timer 1
     TCCR1A = 0x00;        // Normal Mode 
     TCCR1B = 0x01;        // div/1 clock, 1/F_CPU clock
-    TimerValue = 5*F_CPU/SS_CtcssFrequency; // *10/2
+    TimerValue = (SS_CtcssFrequency) ? 5*F_CPU/SS_CtcssFrequency : 0xFFFF; // *10/2, no tone: slowest tick
 
     // Enable interrupts as needed 
     TIMSK1 |= _BV(TOIE1);   // Timer 1 overflow interrupt 
 
+    // }}}
+    // {{{ Timer 2 (LCD transmit queue)
+
+    // CTC mode, div/8 clock, compare match roughly every LCDTICK us
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS21);
+    OCR2A  = (uint8_t)((F_CPU/8) * LCDTICK / 1000000UL) - 1;
+    // the compare match interrupt is enabled by lcdQueuePut()
+
     // }}}
 
     sei();      // Enable global interrupts
@@ -679,6 +1258,9 @@ void initIRQ(void)
 // {{{ void initLCD(void)
 void initLCD(void)
 {
+    // The init sequence needs fixed waits between the commands, so every
+    // step waits for the transmit queue to drain before the delay starts.
+
     // allow the lcd controller to wake up
     _delay_ms(100);
 
@@ -693,6 +1275,7 @@ void initLCD(void)
 
     // 4 bits mode, 2 lines
     lcdCmd(dispFUNC); // 0x20
+    lcdQueueFlush();
     _delay_ms(20);
 
     //lcdCmd(dispFUNC);
@@ -700,41 +1283,34 @@ void initLCD(void)
 
     // cursor shifts to right, text no shift
     lcdCmd(dispSHIF); // 0x18
+    lcdQueueFlush();
     _delay_ms(40);
 
     // display on, no cursor, no blink
     lcdCmd(dispONOF); // 0x0C
+    lcdQueueFlush();
     _delay_ms(40);
 
     // shift mode
     lcdCmd(dispMODE); // 0x06
+    lcdQueueFlush();
     _delay_ms(40);
 
     // clear display
     // leave cursor at top left
     lcdCmd(dispCLEAR); // 0x01
+    lcdQueueFlush();
     _delay_ms(40);
 
 
-    // define custom chars
-    uint8_t i,j;
-    lcdCmd(dispCGRA);
-    for (i=0; i<3; i++) 
-    {
-        for (j=0; j<8; j++) 
-        {
-            lcdData(smeter[i][j]);
-        }
-    }
-
-
-    // welcome message 
-    lcdHome();
-    _delay_ms(40);
+    // custom chars are loaded on demand, see lcdGlyph()
 
+    // welcome message
     //              0123456789ABCDEF
     char hello[] = "PA3BJI sw v0.7  ";
-    lcdStr16(hello);
+    lcdFrameStr(0, hello);
+    lcdFlush();
+    lcdQueueFlush();
     _delay_ms(500);
 }
 
@@ -745,15 +1321,19 @@ void initLCD(void)
 void initADC(void)
 {
 #ifndef TESTING
-    // prescaler: devide by 128
-    // ADC clock = 1MHz / 128 = 7812,5 Hz
-    ADCSRA = (1<<ADPS0)|(1<<ADPS1)|(1<<ADPS2);  
-
     // Disable digital functions on analog input
     DIDR0 = (1<<ADC5D);
 
     // Choose ADC channel 5 
     ADMUX = (1<<REFS0) + 5;         
+
+    // free running (auto trigger source 0), interrupt after each conversion,
+    // ADC clock = F_CPU / ADCPRESCALER
+    ADCSRB = 0;
+    ADCSRA = (1<<ADEN)|(1<<ADATE)|(1<<ADIE)|ADCPS;
+
+    // start the first conversion, the others follow by themselves
+    ADCSRA |= (1<<ADSC);
 #endif
 }
 
@@ -762,27 +1342,19 @@ void initADC(void)
 
 void initPLL(void)
 {
-    int32_t reg;
-
     // clear signal lintes
     cbi(PORTC, ADATA);
     cbi(PORTC, ACLK);
     cbi(PORTC, ALE);
 
-    // init function latch
-    reg = 0x438086;
-    OutputSetPLL(reg);
-
-    // init R-counter c.q. the reference frequency
-    reg = (2UL<<16) + ((SS_PllReferenceFrequency/CHANNELSTEP)<<2);
-    OutputSetPLL(reg);
-
-    // init the start up channel
-    OutputSetVfoFrequency(SS_VfoFrequency);
-
-    // init something else
-    reg = 0x438082;
-    OutputSetPLL(reg);
+    // initialisation latch method: init and function latch,
+    // then the R-counter c.q. the reference frequency,
+    // then the start up channel, PllCommit() keeps that order
+    PllSet(PLL_INIT, PLLINITLATCH);
+    PllSet(PLL_FUNC, PllFunctionWord(SS_FastLock));
+    OutputSetPLLReference(SS_PllReferenceFrequency);
+    PllCounterTrack(&pllRx, SS_VfoFrequency);
+    OutputSetVfoWord(FALSE);
 }
 
 // }}}
@@ -815,7 +1387,7 @@ void initPersistentStorage()
     if (!eeprom)
     {
         eeprom = fopen("eeprom.bin","w");
-        fwrite (&zero,sizeof(int32_t),16,eeprom);
+        fwrite (&zero,sizeof(int32_t),PERSISTENTCOUNT,eeprom);
     }
     fclose(eeprom);
     eeprom = fopen("eeprom.bin","r");
@@ -829,13 +1401,15 @@ void readPersistentStorage(void)
 {
 #ifdef TESTING 
     uint32_t i;
-    for (i=0; i<16; i++)
+    // without eeprom file (headless) start from the factory settings
+    for (i=0; (i<PERSISTENTCOUNT) && eeprom; i++)
     {
         fread((int32_t *)&theMenu[(int)i].value,1,sizeof(int32_t), eeprom);
     }
+    simSavedFrequency = theMenu[5].value;
 #else
     uint8_t i;
-    for (i=0; i<16; i++)
+    for (i=0; i<PERSISTENTCOUNT; i++)
     {
         theMenu[i].value = eeprom_read_dword((uint32_t *)(i*sizeof(uint32_t)));
     }
@@ -851,18 +1425,92 @@ void readPersistentStorage(void)
         theMenu[MMUTELEVEL].value = (uint32_t) SS_MuteLevel;
         eeprom_write_dword((uint32_t *)(MMUTELEVEL*sizeof(uint32_t)), theMenu[MMUTELEVEL].value);
     }
+    theMenu[MSQOPEN].value = SS_MuteLevel;
+
+    SS_SquelchClose = theMenu[MSQCLOSE].value;
+    // integrity checking, never above the open level
+    if (!inbetween(SS_SquelchClose, 0, SS_MuteLevel))
+    {
+        SS_SquelchClose = (INITIAL_SQUELCHCLOSE < SS_MuteLevel) ? INITIAL_SQUELCHCLOSE : SS_MuteLevel;
+        theMenu[MSQCLOSE].value = SS_SquelchClose;
+        eeprom_write_dword((uint32_t *)(MSQCLOSE*sizeof(uint32_t)), theMenu[MSQCLOSE].value);
+    }
+
+    SS_SquelchMinOpen = theMenu[MSQMINOPEN].value;
+    // integrity checking
+    if (!inbetween(theMenu[MSQMINOPEN].value, 0, SQUELCHMAXTIME))
+    {
+        SS_SquelchMinOpen = INITIAL_SQUELCHMINOPEN;
+        theMenu[MSQMINOPEN].value = SS_SquelchMinOpen;
+        eeprom_write_dword((uint32_t *)(MSQMINOPEN*sizeof(uint32_t)), theMenu[MSQMINOPEN].value);
+    }
+
+    SS_SquelchTail = theMenu[MSQTAIL].value;
+    // integrity checking
+    if (!inbetween(theMenu[MSQTAIL].value, 0, SQUELCHMAXTIME))
+    {
+        SS_SquelchTail = INITIAL_SQUELCHTAIL;
+        theMenu[MSQTAIL].value = SS_SquelchTail;
+        eeprom_write_dword((uint32_t *)(MSQTAIL*sizeof(uint32_t)), theMenu[MSQTAIL].value);
+    }
+
+    SS_SquelchAuto = theMenu[MSQAUTO].value;
+    // integrity checking
+    if (!inbetween(theMenu[MSQAUTO].value, FALSE, TRUE))
+    {
+        SS_SquelchAuto = INITIAL_SQUELCHAUTO;
+        theMenu[MSQAUTO].value = SS_SquelchAuto;
+        eeprom_write_dword((uint32_t *)(MSQAUTO*sizeof(uint32_t)), theMenu[MSQAUTO].value);
+    }
+
+    SS_SquelchMargin = theMenu[MSQMARGIN].value;
+    // integrity checking
+    if (!inbetween(theMenu[MSQMARGIN].value, 0, MAXMUTELEVEL))
+    {
+        SS_SquelchMargin = INITIAL_SQUELCHMARGIN;
+        theMenu[MSQMARGIN].value = SS_SquelchMargin;
+        eeprom_write_dword((uint32_t *)(MSQMARGIN*sizeof(uint32_t)), theMenu[MSQMARGIN].value);
+    }
+    SS_OpenLevel = SS_MuteLevel;
 
-    SS_FrequencyShift = theMenu[MSHIFT].value;
+    // integrity checking, 0 is not calibrated
+    for (i=MSMCALLOW; i<=MSMCALHIGH; i++)
+    {
+        if (!inbetween(theMenu[i].value, 0, 1023))
+        {
+            theMenu[i].value = 0;
+            eeprom_write_dword((uint32_t *)(i*sizeof(uint32_t)), theMenu[i].value);
+        }
+    }
+    SMeterCalibrate();
+
+    // memory channels, a channel outside the band is not programmed
+#ifdef TESTING
+    if (eeprom && !fseek(eeprom, MEMCHANEEPROM, SEEK_SET))
+        fread(memory, 1, sizeof(memory), eeprom);
+#else
+    eeprom_read_block(memory, (void *)MEMCHANEEPROM, sizeof(memory));
+#endif
+    for (i=0; i<MEMCHANCOUNT; i++)
+    {
+        if (!inbetween(memory[i].frequency, BANDBOTTOM, BANDTOP))
+            memory[i].frequency = 0;
+        if (!inbetween(memory[i].shift, MINSHIFT, MAXSHIFT))
+            memory[i].shift = 0;
+    }
+    SS_MemoryIndex = MEMCHANCOUNT-1;    // the channel scan starts at the first
+
+    SS_FrequencyShift = PersistentHz(MSHIFT, MINSHIFT, MAXSHIFT);
     // integrity checking
-    if (!inbetween(SS_FrequencyShift, -60000L, 60000L))
+    if (!inbetween(SS_FrequencyShift, MINSHIFT, MAXSHIFT))
     {
         SS_FrequencyShift = INITIAL_SHIFT;
         theMenu[MSHIFT].value = SS_FrequencyShift;
         eeprom_write_dword((uint32_t *)(MSHIFT*sizeof(uint32_t)), theMenu[MSHIFT].value);
     }
     // round up to full MHz
-    SS_FrequencyShift /= 1000;
-    SS_FrequencyShift *= 1000;
+    SS_FrequencyShift /= ONEMHZ;
+    SS_FrequencyShift *= ONEMHZ;
     theMenu[MSHIFT].value = SS_FrequencyShift;
 
     SS_CtcssIndex = (uint8_t)theMenu[MCTCSS].value;
@@ -875,7 +1523,7 @@ void readPersistentStorage(void)
     theMenu[MCTCSS].value = (uint32_t)SS_CtcssIndex;
     SS_CtcssFrequency     = (int16_t) CtcssTones[SS_CtcssIndex];
 
-    SS_ScanStartFrequency = theMenu[MSSTART].value;
+    SS_ScanStartFrequency = PersistentHz(MSSTART, BANDBOTTOM, BANDTOP);
     // integrity checking
     if (!inbetween(SS_ScanStartFrequency,BANDBOTTOM, BANDTOP))
     {
@@ -884,7 +1532,7 @@ void readPersistentStorage(void)
         eeprom_write_dword((uint32_t *)(MSSTART*sizeof(uint32_t)), theMenu[MSSTART].value);
     }
 
-    SS_ScanEndFrequency = theMenu[MSEND].value;
+    SS_ScanEndFrequency = PersistentHz(MSEND, BANDBOTTOM, BANDTOP);
     // integrity checking
     if (!inbetween(SS_ScanEndFrequency,BANDBOTTOM, BANDTOP))
     {
@@ -893,7 +1541,7 @@ void readPersistentStorage(void)
         eeprom_write_dword((uint32_t *)(MSEND*sizeof(uint32_t)), theMenu[MSEND].value);
     }
 
-    SS_BaseFrequency = theMenu[5].value;
+    SS_BaseFrequency = PersistentHz(5, BANDBOTTOM, BANDTOP);
     // integrity checking
     if (!inbetween(SS_BaseFrequency,BANDBOTTOM, BANDTOP))
     {
@@ -921,15 +1569,53 @@ void readPersistentStorage(void)
         eeprom_write_dword((uint32_t *)(MAROTARYTYPE*sizeof(uint32_t)), theMenu[MAROTARYTYPE].value);
     }
 
-    SS_PllReferenceFrequency = theMenu[MAPLLREFMHZ].value;
+    SS_FastLock = theMenu[MAFASTLOCK].value;
+    // integrity checking
+    if (!inbetween(SS_FastLock, FL_OFF, FL_MAX))
+    {
+        SS_FastLock = FL_OFF;
+        theMenu[MAFASTLOCK].value = SS_FastLock;
+        eeprom_write_dword((uint32_t *)(MAFASTLOCK*sizeof(uint32_t)), theMenu[MAFASTLOCK].value);
+    }
+
+    SS_PllReferenceFrequency = PersistentHz(MAPLLREFMHZ, MINREFERENCE, MAXREFERENCE);
+    theMenu[MAPLLREFKHZ].value = SS_PllReferenceFrequency;
     // integrity checking
-    if (!inbetween(SS_PllReferenceFrequency, 5000UL, 150000UL))
+    if (!inbetween(SS_PllReferenceFrequency, MINREFERENCE, MAXREFERENCE))
     {
+        SS_PllReferenceFrequency = INITIAL_REFERENCE;
         theMenu[MAPLLREFMHZ].value = (uint32_t)INITIAL_REFERENCE;
         theMenu[MAPLLREFKHZ].value = (uint32_t)INITIAL_REFERENCE;
         eeprom_write_dword((uint32_t *)(MAPLLREFMHZ*sizeof(uint32_t)), theMenu[MAPLLREFMHZ].value);
         eeprom_write_dword((uint32_t *)(MAPLLREFKHZ*sizeof(uint32_t)), theMenu[MAPLLREFKHZ].value);
     }
+
+    SS_Raster = theMenu[MARASTER].value;
+    // integrity checking
+    if (!inbetween(SS_Raster, RS_25K, RS_MAX))
+    {
+        SS_Raster = INITIAL_RASTER;
+        theMenu[MARASTER].value = SS_Raster;
+        eeprom_write_dword((uint32_t *)(MARASTER*sizeof(uint32_t)), theMenu[MARASTER].value);
+    }
+    ProcSetRaster(SS_Raster);
+}
+
+// }}}
+// {{{ int32_t PersistentHz(uint8_t ix, int32_t low, int32_t high)
+
+// Eeprom contents from before the frequencies were kept in Hz hold kHz.
+// The kHz and Hz ranges do not overlap (a shift of 0 is the same in both),
+// so such a value is recognised and scaled in the menu and the eeprom.
+
+int32_t PersistentHz(uint8_t ix, int32_t low, int32_t high)
+{
+    if (theMenu[ix].value && inbetween(theMenu[ix].value, low/1000, high/1000))
+    {
+        theMenu[ix].value *= 1000;
+        eeprom_write_dword((uint32_t *)(ix*sizeof(uint32_t)), theMenu[ix].value);
+    }
+    return theMenu[ix].value;
 }
 
 // }}}
@@ -939,10 +1625,9 @@ uint32_t sysClock(void)
 {
     register uint32_t rv;
 #ifdef TESTING
-    // posix clock works in uS
+    // virtual clock works in uS
     // dividing by 10000 converts to centiseconds
-    //rv = clock() / 10000L;
-    rv = clock() / 5000L;
+    rv = (uint32_t)(simMicros / 10000UL);
 #else
     // Atmel timer setup uses approximate centiseconds
     ATOMIC_BLOCK(ATOMIC_FORCEON)
@@ -963,7 +1648,8 @@ void initialize(void)
 
     // We need to know about hardware config before running hw init 
 #ifdef TESTING
-    initPersistentStorage();
+    if (!Headless)
+        initPersistentStorage();
 #endif
     readPersistentStorage();
 
@@ -980,6 +1666,8 @@ void initialize(void)
     SS_ShiftEnable          = FALSE;
     SS_ReverseShift         = FALSE;
     SS_Transmitting         = FALSE;
+    SS_Muted                = TRUE;     // the squelch starts closed
+    SS_NoiseFloor           = MAXMUTELEVEL << NOISEFLOORFRACTION;  // and settles down from here
     SS_MenuState            = MAINMENU;
     SS_ValueEdit            = FALSE;
     SS_Tuning               = TRUE;
@@ -988,17 +1676,28 @@ void initialize(void)
     IRQ_RotaryChange        = 0;
     IRQ_Ticks               = 0;
 
+    // the display starts out cleared
+    lcdFrameInit();
+    lcdGlyphInit();
+
 #ifdef TESTING
     //    vInRotState = 9;
     GetcAvail   = FALSE;
     GetcBuffer  = 0;
     PIND |= (1<<PTT); // PTT switch not active!
+    initPLL();
 #else
     initPORTS();
     initPLL();
     initLCD();
     initADC();
     initIRQ(); 
+#ifdef PLL_BENCHMARK
+    PllBenchmark();
+#endif
+#ifdef LCD_BENCHMARK
+    LcdBenchmark();
+#endif
 #endif
 }
 
@@ -1009,151 +1708,491 @@ void initialize(void)
 
 #ifdef TESTING
 
-// {{{ Output Scaffolding
+// {{{ Virtual time
 
-// {{{ ttyControl
+// {{{ void simLoopDone(void)
 
-// {{{ void ttySetCursorPosition(short row, short col)
+// Called at the end of every main loop pass. Keeps the loop time statistics
+// and, when a terminal is attached, sleeps until the wall clock has caught
+// up so the simulator runs at the speed of the real thing. A jump (fast
+// forward) is not slept off, the next pass just continues from there.
 
-void ttySetCursorPosition(short row, short col)
+char     simFastForwarding = FALSE;
+uint32_t simLoopMin = 0xFFFFFFFF;   // modelled loop time statistics in us
+uint32_t simLoopMax;
+uint64_t simLoopSum;
+uint32_t simLoops;
+
+void simLoopDone(void)
 {
-    printf("\033[%d;%df",row+1, col+1);
+    static uint64_t prevMicros;
+    static struct timespec prevWall;
+    struct timespec now;
+    int64_t ahead;
+    uint32_t loop;
+
+    loop = (uint32_t)(simMicros - simLoopStart);
+    if (loop < simLoopMin) simLoopMin = loop;
+    if (loop > simLoopMax) simLoopMax = loop;
+    simLoopSum += loop;
+    simLoops++;
+    simLoopStart = simMicros;
+
+    if (Headless || simFastForwarding)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ahead = (int64_t)(simMicros - prevMicros)
+          - ((now.tv_sec - prevWall.tv_sec) * 1000000L + (now.tv_nsec - prevWall.tv_nsec) / 1000L);
+    if ((ahead > 0) && (ahead < SIMMAXPACE))
+    {
+        usleep(ahead);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    prevMicros = simMicros;
+    prevWall = now;
 }
 
 // }}}
-// {{{ void ttyClearScreen(void)
+// {{{ uint32_t simAverage(uint64_t total)
 
-void ttyClearScreen(void)
+// per loop average of a time total
+
+uint32_t simAverage(uint64_t total)
 {
-    printf("\033[2J");
-    printf("\033[?1h");
+    return (simLoops) ? (uint32_t)(total / simLoops) : 0;
 }
 
 // }}}
+// {{{ void simFastForward(uint32_t ms)
 
-// }}}
-// {{{ Display emulator
+// Run the processing and output handlers for "ms" of virtual time with the
+// inputs held as they are: no rotary steps, no button presses.
 
-void NL(void)
+void simFastForward(uint32_t ms)
 {
-    printf("\n"); 
-    printf ("\r");
-}
-
-// {{{ deSetCursorPosition(short row, short col)
+    uint64_t end = simMicros + ms*1000ULL;
 
-void deSetCursorPosition(short row, short col)
-{
-    ttySetCursorPosition(row+YTop, col+XTop);
+    simFastForwarding = TRUE;
+    while (simMicros < end)
+    {
+        simHeldInputs();
+        SS_RotaryCount = 0;
+        SS_Selected    = FALSE;
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+    }
+    simFastForwarding = FALSE;
 }
 
 // }}}
-// {{{ deTop(void)
+// {{{ void simReport(FILE *f)
 
-void deTop(void)
+// Modelled loop time of the target and, per stage, which calls it went to
+
+void simReport(FILE *f)
 {
-    deSetCursorPosition(0,0);
+    const char *stageName[SIMSTAGES] = { "init", "input", "process", "output" };
+    const char *causeName[SIMCAUSES] = { "delay", "adc", "pll", "eeprom", "lcd", "code" };
+    uint8_t st, c;
+
+    if (simLoops == 0)
+        return;
+    fprintf(f, "modelled loop time: min %u us, avg %u us, max %u us over %u loops\n",
+            simLoopMin, simAverage(simLoopSum), simLoopMax, simLoops);
+    fprintf(f, "average us per loop ");
+    for (c=0; c<SIMCAUSES; c++)
+        fprintf(f, "%8s", causeName[c]);
+    fprintf(f, "\n");
+    for (st=ST_INPUT; st<SIMSTAGES; st++)
+    {
+        fprintf(f, "  %-17s", stageName[st]);
+        for (c=0; c<SIMCAUSES; c++)
+            fprintf(f, "%8u", simAverage(simCost[st][c]));
+        fprintf(f, "\n");
+    }
+    fprintf(f, "  %-17s", stageName[ST_INIT]);
+    for (c=0; c<SIMCAUSES; c++)
+        fprintf(f, "%8u", (uint32_t)simCost[ST_INIT][c]);
+    fprintf(f, "  (total, once)\n");
+    fprintf(f, "PTT to PLL latch: last %u us, max %u us\n", pttLatency, pttLatencyMax);
+    fprintf(f, "PLL bus: %u updates, %u bit-times, %u updates not 24 bits\n",
+            simBus.updates, simBus.clocks, simBus.badUpdates);
 }
 
 // }}}
-// {{{ deData(char c)
-
-void deData(char c)
-{
-    printf("%c",c);
-    //cpos++; 
-    //if (cpos==DISPLAY_WIDTH)
-    //    deSetCursorPosition(2,1);
-}
 
 // }}}
-// {{{ deClearScreen(void)
+// {{{ S-meter ADC
 
-void deClearScreen(void)
+// {{{ void simAdcService(void)
+
+// Runs the ADC interrupts that would have happened since the last call,
+// every conversion sees the simulated signal level. Their run time is
+// charged to the ADC.
+
+void simAdcService(void)
 {
-    short i;
-    deTop();
-    for (i=0; i<DISPLAY_WIDTH; i++)
-    {
-        deData(' ');
-    }
-    deSetCursorPosition(1,0); 
-    for (i=0; i<DISPLAY_WIDTH; i++)
-    {
-        deData(' ');
-    }
+    static uint64_t nextConversion;
 
-    for (i=0; i<DISPLAY_WIDTH; i++)
+    // the ADC starts with the first look at it
+    if (nextConversion == 0)
+        nextConversion = simMicros;
+    while (simMicros >= nextConversion)
     {
-        // DisplayBuffer[0][i]=' ';
-        // DisplayBuffer[1][i]=' ';
+        AdcAccumulate(simuls);
+        nextConversion += ADCCONVERSION;
+        simCharge(SC_ADC, SIMADCISR);
     }
+    // no interrupts until the next call: the flag goes with the value the
+    // loop reads, also when the test code holds SS_SMeterIn
+    SS_SMeterValid = IRQ_SMeterValid;
 }
 
 // }}}
-// {{{ deCmd(char c)
 
-void deCmd(char c)
-{
-    short pos;
-    short row;
+// }}}
+// {{{ ADF4113 bus decoder
 
-    if (c == dispCLEAR)
-    {
-        deClearScreen();
-    }
+// {{{ void simPllBus(void)
 
-    if ((c & 0xFE) == dispHOME) 
+// Called by OutputSetPLL() after every change of ACLK or ALE. Does what the
+// chip does with the pins: a rising clock edge shifts ADATA into the 24 bit
+// register, a rising ALE moves the register into the latch selected by its
+// two control bits. The initialisation latch programs the function latch
+// as well.
+
+void simPllBus(void)
+{
+    uint8_t pins = PORTC & (_BV(ACLK) | _BV(ALE));
+    uint8_t rising = pins & ~simBus.prevPins;
+    uint8_t latch;
+
+    simBus.prevPins = pins;
+    if (rising & _BV(ACLK))
     {
-        deTop();
+        simBus.shift = ((simBus.shift << 1) | ((PORTC & _BV(ADATA)) ? 1 : 0)) & 0xFFFFFFUL;
+        simBus.bits++;
+        simBus.clocks++;
     }
-
-    if ((c & 0x80) == dispDDRA)
+    if (rising & _BV(ALE))
     {
-        pos = c & 0x0F;
-        row = (c & 0x40) ? 1 : 0;
-        deSetCursorPosition(row,pos);
+        latch = simBus.shift & 3;
+        simBus.latch[latch] = simBus.shift;
+        if (latch == PLL_INIT)
+            simBus.latch[PLL_FUNC] = (simBus.shift & ~3UL) | PLL_FUNC;
+        if (latch == PLL_N)
+            simBus.nPins = PORTC & (_BV(TXON) | _BV(MUTE));
+        if (simBus.bits != 24)
+            simBus.badUpdates++;
+        simBus.updates++;
+        simBus.bits = 0;
     }
 }
 
 // }}}
-// {{{ deFrame(void)
+// {{{ uint32_t simPllVco(uint32_t reference)
 
-void deLine(short w)
-{
-    short i;
-    printf("+");
-    for (i=1; i<w; i++)
-        printf("-");
-    printf("+\n"); NL();
-}
+// The frequency in Hz the decoded latches tune the VCO to, with "reference"
+// on the REFin pin: (P*B + A) * reference / R. Returns 0 for counter values
+// the chip can not use (R = 0, B < 3 or B < A).
 
-void deFrame(void)
+uint32_t simPllVco(uint32_t reference)
 {
-    short y;
-
-    // cursor off
-    printf("\033[?25l");   
-
-    deSetCursorPosition(-1, -1);
-    deLine(DISPLAY_WIDTH+1);
-    for (y=0; y<DISPLAY_HEIGHT; y++)
-    {
-        deSetCursorPosition(y, -1);
-        printf("|");
-        deSetCursorPosition(y,DISPLAY_WIDTH);
-        printf("|");
-    }
-    deSetCursorPosition(DISPLAY_HEIGHT, -1);
-    deLine(DISPLAY_WIDTH+1);
+    uint32_t r = (simBus.latch[PLL_R] >> 2) & 0x3FFF;
+    uint32_t a = (simBus.latch[PLL_N] >> 2) & 0x3F;
+    uint32_t b = (simBus.latch[PLL_N] >> 8) & 0x1FFF;
+    uint32_t p = 8UL << ((simBus.latch[PLL_FUNC] >> 22) & 3);   // 8/9 .. 64/65 prescaler
+
+    if ((r == 0) || (b < 3) || (b < a))
+        return 0;
+    return (uint32_t)(((uint64_t)p * b + a) * reference / r);
 }
 
 // }}}
 
 // }}}
-// {{{ char* yesno(short boolean)
+// {{{ Output Scaffolding
 
-char* yesno(short boolean)
+// {{{ ttyControl
+
+// All simulator output goes into a screen model (ttyScreen). ttyRender()
+// compares it with what the terminal shows and sends only the changed
+// characters, as one write() per frame, at most TTYFRAMERATE times a second.
+
+// {{{ void ttySetCursorPosition(short row, short col)
+
+void ttySetCursorPosition(short row, short col)
+{
+    ttyRow = row;
+    ttyCol = col;
+}
+
+// }}}
+// {{{ void ttySetColor(char color)
+
+void ttySetColor(char color)
+{
+    ttyColor = color;
+}
+
+// }}}
+// {{{ void ttyPutc(char c)
+
+void ttyPutc(char c)
+{
+    switch (c)
+    {
+        case '\n' : ttyRow++;
+                    break;
+
+        case '\r' : ttyCol = 0;
+                    break;
+
+        default  : if ((ttyRow >= 0) && (ttyRow < TTYROWS) && (ttyCol >= 0) && (ttyCol < TTYCOLS))
+                   {
+                       ttyScreen     [ttyRow][ttyCol] = c;
+                       ttyScreenColor[ttyRow][ttyCol] = ttyColor;
+                       if (ttyRow > ttyMaxRow) ttyMaxRow = ttyRow;
+                   }
+                   ttyCol++;
+    }
+}
+
+// }}}
+// {{{ void ttyPrintf(const char *fmt, ...)
+
+// printf into the screen model, color escape sequences (ESC[nnm) set
+// the color, other escape sequences are ignored
+
+void ttyPrintf(const char *fmt, ...)
+{
+    char buf[256];
+    char *p;
+    short n;
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    for (p=buf; *p; p++)
+    {
+        if ((p[0] == '\033') && (p[1] == '['))
+        {
+            n = 0;
+            for (p+=2; (*p >= '0') && (*p <= '9'); p++)
+                n = n*10 + (*p - '0');
+            while (*p && ((*p == ';') || (*p == '?') || ((*p >= '0') && (*p <= '9'))))
+                p++;
+            if (*p == 'm')
+                ttySetColor(n);
+            if (!*p)
+                break;
+        } else
+            ttyPutc(*p);
+    }
+}
+
+// }}}
+// {{{ void ttyClearScreen(void)
+
+void ttyClearScreen(void)
+{
+    // clear, cursor keys in application mode, cursor off
+    static const char clear[] = "\033[2J\033[?1h\033[?25l";
+
+    if (write(1, clear, sizeof(clear)-1) < 0) 
+        return;
+    memset(ttyScreen,      ' ', sizeof(ttyScreen));
+    memset(ttyShown,       ' ', sizeof(ttyShown));
+    memset(ttyScreenColor,  0 , sizeof(ttyScreenColor));
+    memset(ttyShownColor,   0 , sizeof(ttyShownColor));
+}
+
+// }}}
+// {{{ void ttyRender(char force)
+
+void ttyRender(char force)
+{
+    static char out[TTYROWS*TTYCOLS*12];
+    static struct timespec prevFrame;
+    struct timespec now;
+    long  ms;
+    int   n = 0;
+    short row, col;
+    short outRow = -1;      // terminal cursor position
+    short outCol = -1;
+    short outColor = -1;    // terminal color
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (now.tv_sec - prevFrame.tv_sec) * 1000L + (now.tv_nsec - prevFrame.tv_nsec) / 1000000L;
+    if (!force && (ms < 1000/TTYFRAMERATE))
+        return;
+    prevFrame = now;
+
+    for (row=0; row<TTYROWS; row++)
+    {
+        for (col=0; col<TTYCOLS; col++)
+        {
+            if ((ttyScreen[row][col]      == ttyShown[row][col]) && 
+                (ttyScreenColor[row][col] == ttyShownColor[row][col]))
+                continue;
+
+            if ((row != outRow) || (col != outCol))
+                n += sprintf(out+n, "\033[%d;%dH", row+1, col+1);
+            if (ttyScreenColor[row][col] != outColor)
+            {
+                outColor = ttyScreenColor[row][col];
+                n += sprintf(out+n, "\033[%dm", outColor);
+            }
+            out[n++] = ttyScreen[row][col];
+            outRow = row;
+            outCol = col+1;
+
+            ttyShown     [row][col] = ttyScreen     [row][col];
+            ttyShownColor[row][col] = ttyScreenColor[row][col];
+        }
+    }
+
+    if (n > 0)
+    {
+        if (write(1, out, n) < 0)
+            return;
+    }
+}
+
+// }}}
+
+// }}}
+// {{{ Display emulator
+
+void NL(void)
+{
+    ttyPrintf("\n\r");
+}
+
+// {{{ deSetCursorPosition(short row, short col)
+
+void deSetCursorPosition(short row, short col)
+{
+    ttySetCursorPosition(row+YTop, col+XTop);
+}
+
+// }}}
+// {{{ deTop(void)
+
+void deTop(void)
+{
+    deSetCursorPosition(0,0);
+}
+
+// }}}
+// {{{ deData(char c)
+
+void deData(char c)
+{
+    // uploads to the character generator are not shown
+    if (deCgram)
+        return;
+    // show custom characters as plain text
+    if ((c >= 0) && (c < GLYPHSLOTS) && (glyphSlot[(int)c] != GL_NONE))
+        c = GlyphText[glyphSlot[(int)c]];
+    ttyPutc(c);
+    //cpos++; 
+    //if (cpos==DISPLAY_WIDTH)
+    //    deSetCursorPosition(2,1);
+}
+
+// }}}
+// {{{ deClearScreen(void)
+
+void deClearScreen(void)
+{
+    short i;
+    deTop();
+    for (i=0; i<DISPLAY_WIDTH; i++)
+    {
+        deData(' ');
+    }
+    deSetCursorPosition(1,0); 
+    for (i=0; i<DISPLAY_WIDTH; i++)
+    {
+        deData(' ');
+    }
+
+    for (i=0; i<DISPLAY_WIDTH; i++)
+    {
+        // DisplayBuffer[0][i]=' ';
+        // DisplayBuffer[1][i]=' ';
+    }
+}
+
+// }}}
+// {{{ deCmd(char c)
+
+void deCmd(char c)
+{
+    short pos;
+    short row;
+
+    // addressing the character generator, or back to display ram
+    deCgram = ((c & 0xC0) == dispCGRA);
+
+    if (c == dispCLEAR)
+    {
+        deClearScreen();
+    }
+
+    if ((c & 0xFE) == dispHOME) 
+    {
+        deTop();
+    }
+
+    if ((c & 0x80) == dispDDRA)
+    {
+        pos = c & 0x0F;
+        row = (c & 0x40) ? 1 : 0;
+        deSetCursorPosition(row,pos);
+    }
+}
+
+// }}}
+// {{{ deFrame(void)
+
+void deLine(short w)
+{
+    short i;
+    ttyPrintf("+");
+    for (i=1; i<w; i++)
+        ttyPrintf("-");
+    ttyPrintf("+\n"); NL();
+}
+
+void deFrame(void)
+{
+    short y;
+
+    deSetCursorPosition(-1, -1);
+    deLine(DISPLAY_WIDTH+1);
+    for (y=0; y<DISPLAY_HEIGHT; y++)
+    {
+        deSetCursorPosition(y, -1);
+        ttyPrintf("|");
+        deSetCursorPosition(y,DISPLAY_WIDTH);
+        ttyPrintf("|");
+    }
+    deSetCursorPosition(DISPLAY_HEIGHT, -1);
+    deLine(DISPLAY_WIDTH+1);
+}
+
+// }}}
+
+// }}}
+// {{{ char* yesno(short boolean)
+
+char* yesno(short boolean)
 {
     // green -> light gray
     static char myes[]="\033[32myes\033[37m";
@@ -1295,6 +2334,15 @@ char InputGetPTT(void)
     if (prevPttActive != pttActive)
     {
         prevPttActive = pttActive;
+        // switch the PLL right away, the rest of the loop can wait. The
+        // transmitter comes on after lock in OutputHandler(), but goes off
+        // (audio still muted) before the receive word leaves the TX frequency
+        if (!pttActive)
+        {
+            OutputSetTransmitterOn(FALSE);
+            sbi(PORTC, MUTE);
+        }
+        OutputSetVfoWord(pttActive);
         // if PTT activated return 1
         // if PTT released return  2
         // return 0 on no-change
@@ -1393,18 +2441,17 @@ uint16_t InputGetSMeter(void)
     if (simuls>hoog) { simuls=hoog; rising=FALSE; }
     if (simuls<laag) { simuls=laag; rising=TRUE; }
     //    }
-    return simuls;
-#else
-    // set AD Start Conversion bit and AD ENable bit
-    ADCSRA |= (1<<ADSC)|(1<<ADEN); 
-
-    // wait for conversion to finish
-    // this is indicated by the ADSC bit clear
-    while ((ADCSRA & (1<<ADSC))!=0);
-
-    // apparantly ADC is a 16 bit register
-    return ADC;
+    simAdcService();
 #endif
+    uint16_t value;
+
+    // no waiting: the ADC interrupt keeps the value up to date,
+    // reading the 16 bits must not be split by it
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        value = IRQ_SMeter;
+    }
+    return value;
 }
 
 // }}}
@@ -1414,12 +2461,17 @@ uint16_t InputGetSMeter(void)
 char InputHandler(void)
 {
     char busy = TRUE;
+    SIMSTAGE(ST_INPUT);
+    // PTT first, an edge switches the PLL before any other work
+    SS_PTT         = InputGetPTT();
     if (SS_RotaryType != 1) InputRotaryPoller();
 
     SS_RotaryCount = InputGetRotaryDialCount();
     SS_Selected    = InputGetSelectorPushed();
     SS_ShiftChange = InputGetShiftEnable();
-    SS_PTT         = InputGetPTT();
+    // the flag first: a filter sample in between only makes a valid
+    // reading look like the placeholder, never the other way round
+    SS_SMeterValid = IRQ_SMeterValid;
     SS_SMeterIn    = InputGetSMeter();
 
 #ifdef TESTING
@@ -1452,11 +2504,13 @@ char InputHandler(void)
 
                        // Clear the PTT bit (switch pulls to ground)
             case 't' : PIND &= ~(1<<PTT);
+                       simPttTime = simMicros;
                        theKey = c;
                        break;
 
                        // Set the PTT bit (switch released, pull-up active)
             case 'r' : PIND |= (1<<PTT);
+                       simPttTime = simMicros;
                        theKey = c;
                        break;
 
@@ -1480,6 +2534,14 @@ char InputHandler(void)
                        theKey = c;
                        break;
 
+            case 'f' : simFastForward(SIMFASTFORWARD);
+                       theKey = c;
+                       break;
+
+            case 'u' : simPllFault = !simPllFault;
+                       theKey = c;
+                       break;
+
             default:
                        // swallow unused input characters by 
                        // calling the non-blocking FHEgetc();
@@ -1511,6 +2573,7 @@ void ProcTuning(void)
 
     if (SS_RotaryCount != 0)
     {
+        ProcLeaveMemoryChannel();
         currentTime = sysClock();
         stepTime = currentTime - lastFrequencyChange;
         // when the tuning steps have been arriving faster 
@@ -1537,7 +2600,7 @@ void ProcTuning(void)
         if (SS_FastTune)
             SS_BaseFrequency += (SS_RotaryCount * ONEMHZ);
         else
-            SS_BaseFrequency += (SS_RotaryCount * CHANNELSTEP);
+            SS_BaseFrequency += (SS_RotaryCount * SS_ChannelStep);
         SS_RotaryCount = 0;
 
         // make sure we're in-band
@@ -1576,12 +2639,25 @@ void ProcTuning(void)
 
 void ProcTuneSave(void)
 {
+    // a scan steps every few cs: saving each channel would wear out the
+    // eeprom cell, the channel it stops on is saved once it stopped
+    if (SS_Scanning)
+        return;
+
     if ((sysClock() - lastFrequencyChange) > 100) //  ~ 2 sec
     {
         SS_FastTune = FALSE; // just to be sure
         theMenu[5].value = SS_BaseFrequency;
         // position 5 is not used for regular menu value storage
 #ifdef TESTING
+        // eeprom_update_dword() only writes when the value changed
+        if (theMenu[5].value != simSavedFrequency)
+        {
+            simCharge(SC_EEPROM, SIMEEPROMWRITE);
+            simSavedFrequency = theMenu[5].value;
+            simFrequencySaves++;
+        } else
+            simCharge(SC_EEPROM, SIMEEPROMREAD);
         tmpFreqChanged = FALSE;
         tmpFreqSaved = TRUE;
 #else
@@ -1629,15 +2705,50 @@ void ProcValueEditing(void)
     { 
         switch (SS_MenuState)
         {
-            case MMUTELEVEL :
+            // the close level follows a lower open level
+            case MSQOPEN :
                 SS_MuteLevel+= SS_RotaryCount;
                 if (SS_MuteLevel > MAXMUTELEVEL) SS_MuteLevel = MAXMUTELEVEL;
                 if (SS_MuteLevel < 0)            SS_MuteLevel = 0;
                 theMenu[SS_MenuState].value    = SS_MuteLevel;
+                theMenu[MMUTELEVEL].value      = SS_MuteLevel;
+                if (SS_SquelchClose > SS_MuteLevel) SS_SquelchClose = SS_MuteLevel;
+                theMenu[MSQCLOSE].value        = SS_SquelchClose;
+                break;
+
+            case MSQCLOSE :
+                SS_SquelchClose += SS_RotaryCount;
+                if (SS_SquelchClose > SS_MuteLevel) SS_SquelchClose = SS_MuteLevel;
+                if (SS_SquelchClose < 0)            SS_SquelchClose = 0;
+                theMenu[SS_MenuState].value    = SS_SquelchClose;
+                break;
+
+            case MSQMINOPEN :
+            case MSQTAIL :
+                theMenu[SS_MenuState].value += SS_RotaryCount * SQUELCHTIMESTEP;
+                if (theMenu[SS_MenuState].value > SQUELCHMAXTIME) theMenu[SS_MenuState].value = SQUELCHMAXTIME;
+                if (theMenu[SS_MenuState].value < 0)              theMenu[SS_MenuState].value = 0;
+                break;
+
+            case MSQAUTO :
+                if (SS_RotaryCount % 2)
+                    theMenu[SS_MenuState].value = !theMenu[SS_MenuState].value;
+                break;
+
+            case MSCSAVE :
+                theMenu[SS_MenuState].value += SS_RotaryCount;
+                if (theMenu[SS_MenuState].value > MEMCHANCOUNT) theMenu[SS_MenuState].value = MEMCHANCOUNT;
+                if (theMenu[SS_MenuState].value < 1)            theMenu[SS_MenuState].value = 1;
+                break;
+
+            case MSQMARGIN :
+                theMenu[SS_MenuState].value += SS_RotaryCount;
+                if (theMenu[SS_MenuState].value > MAXMUTELEVEL) theMenu[SS_MenuState].value = MAXMUTELEVEL;
+                if (theMenu[SS_MenuState].value < 0)            theMenu[SS_MenuState].value = 0;
                 break;
 
             case MSHIFT :
-                SS_FrequencyShift += (SS_RotaryCount*1000);
+                SS_FrequencyShift += (SS_RotaryCount*ONEMHZ);
                 if (SS_FrequencyShift > MAXSHIFT) SS_FrequencyShift = MAXSHIFT;
                 if (SS_FrequencyShift < MINSHIFT) SS_FrequencyShift = MINSHIFT;
                 theMenu[SS_MenuState].value     = SS_FrequencyShift;                
@@ -1653,14 +2764,14 @@ void ProcValueEditing(void)
                 break;
 
             case MSSTART :
-                SS_ScanStartFrequency += (SS_RotaryCount * CHANNELSTEP);
+                SS_ScanStartFrequency += (SS_RotaryCount * SS_ChannelStep);
                 if (SS_ScanStartFrequency < BANDBOTTOM) SS_ScanStartFrequency = BANDBOTTOM;
                 if (SS_ScanStartFrequency > SS_ScanEndFrequency) SS_ScanStartFrequency = SS_ScanEndFrequency;
                 theMenu[SS_MenuState].value = SS_ScanStartFrequency;
                 break;
 
             case MSEND :
-                SS_ScanEndFrequency += (SS_RotaryCount * CHANNELSTEP);
+                SS_ScanEndFrequency += (SS_RotaryCount * SS_ChannelStep);
                 if (SS_ScanEndFrequency < SS_ScanStartFrequency) SS_ScanEndFrequency = SS_ScanStartFrequency;
                 if (SS_ScanEndFrequency > BANDTOP)    SS_ScanEndFrequency = BANDTOP;
                 theMenu[SS_MenuState].value = SS_ScanEndFrequency;
@@ -1671,26 +2782,21 @@ void ProcValueEditing(void)
                 SS_DirectMenuReturn = (SS_RotaryCount==1) ? TRUE : FALSE;
                 theMenu[SS_MenuState].value = SS_DirectMenuReturn;
                 break;
-                /*
-                   case MASMCALIB :
-                   SS_SMeterCalib += SS_RotaryCount;
-                   break;
-                 */
                 // ADF4113HV   Fref = 5 .. 150 MHz
             case MAPLLREFMHZ :
-                SS_PllReferenceFrequency += SS_RotaryCount * 1000;
-                if (SS_PllReferenceFrequency <   5000UL) SS_PllReferenceFrequency =   5000UL;
-                if (SS_PllReferenceFrequency > 150000UL) SS_PllReferenceFrequency = 150000UL;
+                SS_PllReferenceFrequency += SS_RotaryCount * ONEMHZ;
+                if (SS_PllReferenceFrequency < MINREFERENCE) SS_PllReferenceFrequency = MINREFERENCE;
+                if (SS_PllReferenceFrequency > MAXREFERENCE) SS_PllReferenceFrequency = MAXREFERENCE;
                 theMenu[SS_MenuState  ].value = SS_PllReferenceFrequency;
                 theMenu[SS_MenuState+1].value = SS_PllReferenceFrequency;
                 break;
 
             case MAPLLREFKHZ :
                 kHz = SS_PllReferenceFrequency;
-                kHz += SS_RotaryCount;
-                kHz = kHz % 1000;                   // Stay in the kHz range
-                SS_PllReferenceFrequency /= 1000;   // Integer devide by 1000, followed by...
-                SS_PllReferenceFrequency *= 1000;   // multiply by 1000 to set the lower 3 digits to 0
+                kHz += SS_RotaryCount * 1000L;
+                kHz = kHz % ONEMHZ;                 // Stay in the kHz range
+                SS_PllReferenceFrequency /= ONEMHZ; // Integer devide by 1 MHz, followed by...
+                SS_PllReferenceFrequency *= ONEMHZ; // multiply by 1 MHz to set the lower 6 digits to 0
                 SS_PllReferenceFrequency += kHz;    // Now add in the kHz value.
                 theMenu[SS_MenuState  ].value = SS_PllReferenceFrequency;
                 theMenu[SS_MenuState-1].value = SS_PllReferenceFrequency;
@@ -1723,6 +2829,20 @@ void ProcValueEditing(void)
                 SS_FrontEnable = (SS_RotaryCount==1) ? TRUE : FALSE;
                 theMenu[SS_MenuState].value = SS_FrontEnable;
                 break;
+
+            case MAFASTLOCK :
+                SS_FastLock += SS_RotaryCount;
+                if (SS_FastLock < FL_OFF) SS_FastLock = FL_OFF;
+                if (SS_FastLock > FL_MAX) SS_FastLock = FL_MAX;
+                theMenu[SS_MenuState].value = (int32_t)SS_FastLock;
+                break;
+
+            // the new raster only takes effect on select, see ProcSetRaster()
+            case MARASTER :
+                theMenu[SS_MenuState].value += SS_RotaryCount;
+                if (theMenu[SS_MenuState].value < RS_25K) theMenu[SS_MenuState].value = RS_25K;
+                if (theMenu[SS_MenuState].value > RS_MAX) theMenu[SS_MenuState].value = RS_MAX;
+                break;
         }
         // swallow the rotary pulses used
         SS_RotaryCount = 0;
@@ -1741,6 +2861,7 @@ void ProcSelectDuringTune(void)
     SS_Tuning   = FALSE;        // rotary input now goes to menu
     SS_Scanning = FALSE;        // stop scanning on entering menu
     SS_ValueEdit= FALSE;
+    ProcLeaveMemoryChannel();   // the menu edits the VFO settings
 }
 
 // }}}
@@ -1761,13 +2882,48 @@ void ProcSelectDuringMenu(void)
             SS_MenuState = MAINMENU;
             break;
 
-        case MSCAN :
+        case MSQBACK2MAIN :
+            SS_MenuState = MMUTELEVEL;
+            break;
+
+        case MASMCALIB :        // Goto the S-meter calibration submenu
+            SS_MenuState = SUBMENU3;
+            break;
+
+        case MSMBACK2SET :
+            SS_MenuState = MASMCALIB;
+            break;
+
+        case MMUTELEVEL :       // Goto the squelch submenu
+            SS_MenuState = SUBMENU2;
+            break;
+
+        case MSCAN :            // Goto the scanning submenu
+            SS_MenuState = SUBMENU4;
+            break;
+
+        case MSCBAND :
+            ProcLeaveMemoryChannel();
             SS_Tuning = TRUE;   // switch to tuning mode
             SS_ScanMode = SM_STEP; // goto to step scanning mode
             SS_Scanning = TRUE; // and go to scanning mode
             prevFreq = 0L;      // force update of freq display
             break;
 
+        case MSCMEMORY :
+            SS_Tuning = TRUE;   // switch to tuning mode
+            prevFreq = 0L;      // force update of freq display
+            if (ProcNextMemoryChannel())
+            {
+                SS_ScanMode = SM_CHANNEL;
+                SS_Scanning = TRUE;
+            }
+            break;
+
+        case MSCBACK2MAIN :
+            SS_MenuState = MSCAN;
+            break;
+
         case MSETTINGS :        // Goto the first submenu
             SS_MenuState = SUBMENU1;
             break;
@@ -1782,6 +2938,8 @@ void ProcSelectDuringMenu(void)
 
 void ProcSelectDuringEdit(void)
 {
+    uint8_t i;
+
     // here we are already in menu handling mode AND editing values
     if (!SS_Tuning && SS_ValueEdit) 
     {
@@ -1793,9 +2951,56 @@ void ProcSelectDuringEdit(void)
     }
     switch (SS_MenuState)
     {
-        case MMUTELEVEL :
+        case MSQOPEN :
             SS_MuteLevel = theMenu[SS_MenuState].value;
             eeprom_write_dword((uint32_t *)(MMUTELEVEL*sizeof(uint32_t)),theMenu[MMUTELEVEL].value);
+            eeprom_write_dword((uint32_t *)(MSQCLOSE*sizeof(uint32_t)),theMenu[MSQCLOSE].value);
+            break;
+
+        case MSQCLOSE :
+            SS_SquelchClose = theMenu[SS_MenuState].value;
+            eeprom_write_dword((uint32_t *)(MSQCLOSE*sizeof(uint32_t)),theMenu[MSQCLOSE].value);
+            break;
+
+        case MSQMINOPEN :
+            SS_SquelchMinOpen = theMenu[SS_MenuState].value;
+            eeprom_write_dword((uint32_t *)(MSQMINOPEN*sizeof(uint32_t)),theMenu[MSQMINOPEN].value);
+            break;
+
+        case MSQTAIL :
+            SS_SquelchTail = theMenu[SS_MenuState].value;
+            eeprom_write_dword((uint32_t *)(MSQTAIL*sizeof(uint32_t)),theMenu[MSQTAIL].value);
+            break;
+
+        case MSQAUTO :
+            SS_SquelchAuto = theMenu[SS_MenuState].value;
+            eeprom_write_dword((uint32_t *)(MSQAUTO*sizeof(uint32_t)),theMenu[MSQAUTO].value);
+            break;
+
+        case MSQMARGIN :
+            SS_SquelchMargin = theMenu[SS_MenuState].value;
+            eeprom_write_dword((uint32_t *)(MSQMARGIN*sizeof(uint32_t)),theMenu[MSQMARGIN].value);
+            break;
+
+        // the channel gets what is tuned now, the shift only when switched on
+        case MSCSAVE :
+            i = theMenu[SS_MenuState].value - 1;
+            memory[i].frequency = SS_BaseFrequency;
+            memory[i].shift     = (SS_ShiftEnable) ? SS_FrequencyShift : 0;
+            memory[i].ctcss     = SS_CtcssFrequency;
+            eeprom_write_block(&memory[i], (void *)(MEMCHANEEPROM + i*sizeof(struct MemoryChannelStruct)),
+                    sizeof(struct MemoryChannelStruct));
+            break;
+
+        // the calibration signal is on the antenna: record the S-meter,
+        // unless it is off the slope of the curve (the menu says so)
+        case MSMCALLOW :
+        case MSMCALHIGH :
+            if (!SMeterOnSlope(SS_SMeterIn))
+                break;
+            theMenu[SS_MenuState].value = SS_SMeterIn;
+            eeprom_write_dword((uint32_t *)(SS_MenuState*sizeof(uint32_t)),theMenu[SS_MenuState].value);
+            SMeterCalibrate();
             break;
 
         case MSHIFT :
@@ -1806,7 +3011,7 @@ void ProcSelectDuringEdit(void)
         case MCTCSS:
             SS_CtcssIndex = theMenu[SS_MenuState].value;
             SS_CtcssFrequency = CtcssTones[SS_CtcssIndex];
-            TimerValue = 5*F_CPU/SS_CtcssFrequency; // *10/2
+            TimerValue = (SS_CtcssFrequency) ? 5*F_CPU/SS_CtcssFrequency : 0xFFFF; // *10/2, no tone: slowest tick
             eeprom_write_dword((uint32_t *)(MCTCSS*sizeof(uint32_t)),theMenu[MCTCSS].value);
             break;
 
@@ -1840,6 +3045,16 @@ void ProcSelectDuringEdit(void)
             SS_RemoteEnable = theMenu[SS_MenuState].value;
             eeprom_write_dword((uint32_t *)(MAREMOTEENABLE*sizeof(uint32_t)),theMenu[MAREMOTEENABLE].value);
             break;
+
+        case MAFASTLOCK :
+            SS_FastLock = theMenu[SS_MenuState].value;
+            eeprom_write_dword((uint32_t *)(MAFASTLOCK*sizeof(uint32_t)),theMenu[MAFASTLOCK].value);
+            break;
+
+        case MARASTER :
+            ProcSetRaster(theMenu[SS_MenuState].value);
+            eeprom_write_dword((uint32_t *)(MARASTER*sizeof(uint32_t)),theMenu[MARASTER].value);
+            break;
     }
 }
 
@@ -1873,16 +3088,20 @@ void ProcPTT()
 
 void ProcShiftEnable()
 {
+    // on a memory channel the channel has its own shift, the switch sets
+    // the VFO one that ProcLeaveMemoryChannel() brings back
+    char *shiftEnable = (SS_MemoryChannel) ? &vfoShiftEnable : &SS_ShiftEnable;
+
     switch (SS_ShiftChange)
     {
         // activated
         case 1  :
-            SS_ShiftEnable = TRUE;
+            *shiftEnable = TRUE;
             break;
 
             // released
         case 2  :
-            SS_ShiftEnable = FALSE;
+            *shiftEnable = FALSE;
             break;
     }
 }
@@ -1890,35 +3109,105 @@ void ProcShiftEnable()
 // }}}
 // {{{ // SMeter and Squelch 
 
+// The squelch opens at SS_MuteLevel (or when the ADC interrupt opened it
+// already) and closes below SS_SquelchClose, but not before it was open
+// for SS_SquelchMinOpen and the signal was gone for SS_SquelchTail.
+// A signal fluttering around one level no longer toggles the audio.
+//
+// The auto squelch opens SS_SquelchMargin above the noise floor instead,
+// with the same gap between the open and the close level. The floor is a
+// low percentile of the S-meter: every cs it steps a whole unit down when
+// the level is below it, or a sixteenth up when above, so it settles where
+// one sample in 17 is lower. While the squelch is open it rises 4 times
+// slower, or 64 times for a level more than the margin above the open
+// level: a station hardly raises it, a noisier band still closes the
+// squelch (a big noise step after a minute or so).
+// From a retune until the first filter sample on the new channel the
+// S-meter reads the no signal placeholder (SS_SMeterValid is FALSE): the
+// floor and the squelch are left as they are, or a scan would pull the
+// floor down on every step and then stop on plain noise.
+
 void ProcSMeterSquelch()
 {
     static char prevMute;
+    static uint32_t openTime;       // when the squelch opened
+    static uint32_t signalTime;     // last time the signal was at the close level or above
+    static uint32_t floorTime;      // last noise floor update
+    static uint16_t openTicks;      // cs counted towards a rise while open
+    uint32_t now;
+    uint16_t level, ticks, down, rate;
+    int16_t open, close;
 
     if (!SS_Transmitting)
     {
-        // make sure we do net get negative values in the result
-        if (SS_SMeterIn > 980) SS_SMeterIn = 980;
-
         //SS_DisplaySMeter = ((1024-SS_SMeterIn) - 44) >> 1;
-        SS_DisplaySMeter = (980 - SS_SMeterIn) >> 1;
-
-        // low pass s-meter signal
-        SS_DisplaySMeter += LowPass;
-        SS_DisplaySMeter >>= 1;
-        LowPass = SS_DisplaySMeter;
+        // already low passed by the ADC interrupt, see AdcAccumulate()
+        SS_DisplaySMeter = SMeterScale(SS_SMeterIn);
 
         prevMute = SS_Muted;
-        SS_Muted = (SS_MuteLevel > SS_DisplaySMeter);
+        now = sysClock();
+
+        // noise floor, once per cs (more steps at once after a slow pass)
+        ticks = ((now - floorTime) > 100) ? 100 : (now - floorTime);
+        floorTime = now;
+        if (!SS_SMeterValid)
+            ticks = 0;
+        if (!SS_Muted)
+        {
+            rate = (SS_DisplaySMeter < SS_OpenLevel + SS_SquelchMargin) ? NOISEFLOOROPENRATE : NOISEFLOORSTRONGRATE;
+            openTicks += ticks;
+            ticks = openTicks / rate;
+            openTicks %= rate;
+        }
+        level = SS_DisplaySMeter << NOISEFLOORFRACTION;
+        if (level < SS_NoiseFloor)
+        {
+            down = ticks * NOISEFLOORDOWN;
+            SS_NoiseFloor -= ((SS_NoiseFloor - level) < down) ? (SS_NoiseFloor - level) : down;
+        } else
+            SS_NoiseFloor += ticks * NOISEFLOORUP;
 
-        // see if audio just went quiet
-        if (SS_ScanMode != SM_NONE)
-            if ((SS_Muted) && (!prevMute))
+        if (SS_SquelchAuto)
+            open = (SS_NoiseFloor >> NOISEFLOORFRACTION) + SS_SquelchMargin;
+        else
+            open = SS_MuteLevel;
+        close = open - (SS_MuteLevel - SS_SquelchClose);
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            SS_OpenLevel = open;
+        }
+
+        if (!SS_SMeterValid)
+        {
+            // retuning, nothing to decide on yet
+        } else if (SS_Muted)
+        {
+            if (IRQ_SquelchOpen || (SS_DisplaySMeter >= open))
+            {
+                SS_Muted = FALSE;
+                openTime = signalTime = now;
+            }
+        } else
+        {
+            if (SS_DisplaySMeter >= close)
+                signalTime = now;
+            else if (((now - openTime) >= SS_SquelchMinOpen) && ((now - signalTime) >= SS_SquelchTail))
+            {
+                SS_Muted = TRUE;
+                IRQ_SquelchOpen = FALSE;
+            }
+        }
+
+        // see if audio just went quiet
+        if (SS_ScanMode != SM_NONE)
+            if ((SS_Muted) && (!prevMute))
             {
                 // timestamp of squelch activation
                 channelCloseTime = sysClock();
             }
     } else {
         SS_Muted = TRUE;
+        IRQ_SquelchOpen = FALSE;
         SS_DisplaySMeter = 0;
     }
     SS_MuteIndicator = (SS_Muted) ? 'M' : ' ';
@@ -1931,26 +3220,44 @@ void ProcScanner()
 {
     uint32_t inactivity;
     char goStep;  // boolean: indicates it's time for the next scanner step
+    char carrier; // boolean: the ADC interrupt saw the squelch open since the last pass
 
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        carrier = IRQ_Carrier;
+        IRQ_Carrier = FALSE;
+    }
 
     // only read and save timestamp when really usefull
     if (SS_ScanMode != SM_NONE)
         currentTime = sysClock();
 
-    // stop scanning when found a busy channel
-    if (!SS_Muted) SS_Scanning = FALSE;
+    // stop scanning when found a busy channel, also when the signal was
+    // too short for the main loop to see
+    if (!SS_Muted || carrier) SS_Scanning = FALSE;
 
     if (SS_Scanning)
     {   
         channelCloseTime = currentTime; // keep inactivity at 0
-        uint16_t StepDelay=50; // clock works rougly in centi seconds 
-        goStep = (currentTime - prevStepTime) > StepDelay;
+        // the output handler waits for lock after each step, so the
+        // channel only needs to be watched long enough for the squelch
+        goStep = (currentTime - prevStepTime) > ScanStepDelay;
         if (goStep)
         {   
             prevStepTime = currentTime;
-            SS_BaseFrequency = SS_BaseFrequency+CHANNELSTEP;
-            if (SS_BaseFrequency > SS_ScanEndFrequency) 
-                SS_BaseFrequency = SS_ScanStartFrequency;
+            if (SS_ScanMode == SM_CHANNEL)
+            {
+                if (!ProcNextMemoryChannel())
+                {
+                    SS_Scanning = FALSE;        // all channels were cleared
+                    SS_ScanMode = SM_NONE;
+                }
+            } else
+            {
+                SS_BaseFrequency = SS_BaseFrequency+SS_ChannelStep;
+                if (SS_BaseFrequency > SS_ScanEndFrequency) 
+                    SS_BaseFrequency = SS_ScanStartFrequency;
+            }
         }
     } else
     {
@@ -1967,12 +3274,96 @@ void ProcScanner()
     }
 }
 
+// }}}
+// {{{ char ProcNextMemoryChannel(void)
+
+// Tune to the next programmed memory channel after SS_MemoryIndex, with
+// its shift and CTCSS tone. A channel without shift switches the shift off
+// but leaves the shift setting alone. The frequency is put on the current
+// raster, the channel may be saved with another one. The VFO's own shift
+// and tone are saved on the first channel, ProcLeaveMemoryChannel() puts
+// them back.
+// Returns FALSE when no channel is programmed.
+
+char ProcNextMemoryChannel(void)
+{
+    uint8_t i;
+    int8_t  ix = SS_MemoryIndex;
+
+    for (i=0; i<MEMCHANCOUNT; i++)
+    {
+        if (++ix >= MEMCHANCOUNT)
+            ix = 0;
+        if (memory[ix].frequency)
+        {
+            if (!SS_MemoryChannel)
+            {
+                vfoShiftEnable    = SS_ShiftEnable;
+                vfoFrequencyShift = SS_FrequencyShift;
+                vfoCtcssIndex     = SS_CtcssIndex;
+                SS_MemoryChannel  = TRUE;
+            }
+            SS_MemoryIndex   = ix;
+            SS_BaseFrequency = memory[ix].frequency - (memory[ix].frequency % SS_ChannelStep);
+            SS_ShiftEnable   = (memory[ix].shift != 0);
+            if (SS_ShiftEnable)
+                SS_FrequencyShift = memory[ix].shift;
+            SS_CtcssIndex     = CtcssIndexOf(memory[ix].ctcss);
+            SS_CtcssFrequency = CtcssTones[SS_CtcssIndex];
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// }}}
+// {{{ void ProcLeaveMemoryChannel(void)
+
+// Back to the VFO shift and tone, and the menu values that show them, and
+// the end of a channel scan. A scan stopped by the PTT keeps the channel's
+// settings to transmit with, tuning away, the menu or a band scan leave it.
+
+void ProcLeaveMemoryChannel(void)
+{
+    if (SS_MemoryChannel)
+    {
+        SS_MemoryChannel  = FALSE;
+        SS_ShiftEnable    = vfoShiftEnable;
+        SS_FrequencyShift = vfoFrequencyShift;
+        SS_CtcssIndex     = vfoCtcssIndex;
+        SS_CtcssFrequency = CtcssTones[SS_CtcssIndex];
+        theMenu[MSHIFT].value = SS_FrequencyShift;
+        theMenu[MCTCSS].value = SS_CtcssIndex;
+        if (SS_ScanMode == SM_CHANNEL)
+        {
+            SS_ScanMode = SM_NONE;
+            SS_Scanning = FALSE;
+        }
+    }
+}
+
+// }}}
+// {{{ int8_t CtcssIndexOf(uint16_t tone)
+
+// position of tone in CtcssTones[], 0 (no tone) when it is not in there
+
+int8_t CtcssIndexOf(uint16_t tone)
+{
+    int8_t i;
+
+    for (i=ctcssLength; i>0; i--)
+        if (CtcssTones[i] == tone)
+            break;
+    return i;
+}
+
 // }}}
 // {{{ // Frequency Calculations
 
 void ProcFrequencyCalculator(void)
 {
     int32_t offset;
+    int32_t rxOffset, txOffset;
 
     SS_VfoFrequency     = SS_BaseFrequency - ((SS_Transmitting) ? 0L : IF);
     SS_DisplayFrequency = SS_BaseFrequency;
@@ -1981,12 +3372,50 @@ void ProcFrequencyCalculator(void)
     offset = (SS_ShiftEnable && (SS_Transmitting != SS_ReverseShift)) ? SS_FrequencyShift : 0L;
     SS_VfoFrequency     += offset;
     SS_DisplayFrequency += offset;
+
+    // keep both N words ready, so a PTT edge can switch the PLL at once
+    rxOffset = (SS_ShiftEnable &&  SS_ReverseShift) ? SS_FrequencyShift : 0L;
+    txOffset = (SS_ShiftEnable && !SS_ReverseShift) ? SS_FrequencyShift : 0L;
+    PllCounterTrack(&pllRx, SS_BaseFrequency - IF + rxOffset);
+    PllCounterTrack(&pllTx, SS_BaseFrequency + txOffset);
+}
+
+// }}}
+// {{{ void ProcSetRaster(int8_t raster)
+
+// Everything that depends on the channel raster is worked out here, once
+// per raster change, so tuning, scanning and the PLL counters only add and
+// compare: the channel step, one MHz in N counter steps, and the tuned and
+// scan frequencies moved down onto the new raster. The R word follows in
+// OutputSetPLLReference().
+
+void ProcSetRaster(int8_t raster)
+{
+    int32_t channels;
+
+    SS_Raster      = raster;
+    SS_ChannelStep = RasterSteps[raster];
+    channels       = ONEMHZ / SS_ChannelStep;
+    pllMHzB        = channels / PLLPRESCALER;
+    pllMHzA        = channels % PLLPRESCALER;
+
+    SS_BaseFrequency      -= SS_BaseFrequency % SS_ChannelStep;
+    SS_ScanStartFrequency -= SS_ScanStartFrequency % SS_ChannelStep;
+    SS_ScanEndFrequency   -= SS_ScanEndFrequency % SS_ChannelStep;
+    theMenu[5].value       = SS_BaseFrequency;
+    theMenu[MSSTART].value = SS_ScanStartFrequency;
+    theMenu[MSEND].value   = SS_ScanEndFrequency;
+
+    // the counters were made for the old step
+    PllCounterSet(&pllRx, pllRx.freq);
+    PllCounterSet(&pllTx, pllTx.freq);
 }
 
 // }}}
 
 void ProcessingHandler(void)
 {
+    SIMSTAGE(ST_PROCESS);
     // {{{ // Rotary Handling
 
     // Tuning is only allowed during receive
@@ -2034,6 +3463,91 @@ void ProcessingHandler(void)
 // }}} Processing
 // {{{ Output functions
 
+// {{{ Formatting
+
+// The display lines are built with these routines instead of sprintf.
+// Digits are extracted by subtracting powers of ten, the AVR has no
+// divide instruction and a 32 bit division is a slow library call.
+
+// {{{ char *fmtText(char *dst, char *s, uint8_t width)
+
+// copy s to dst, left aligned and padded with spaces to width characters
+// returns a pointer to the terminating zero
+
+char *fmtText(char *dst, char *s, uint8_t width)
+{
+    while (*s)
+    {
+        *dst++ = *s++;
+        if (width) width--;
+    }
+    while (width--)
+        *dst++ = ' ';
+    *dst = 0;
+    return dst;
+}
+
+// }}}
+// {{{ char *fmtNumber(char *dst, int32_t value, uint8_t width, uint8_t decimals)
+
+// print value right aligned in a field of width characters, with a
+// decimal point before the last decimals digits: Hz values print as
+// MHz with decimals=6, CTCSS tenths of Hz with decimals=1. Decimals past
+// the third are left out when zero, so MHz show 3 decimals, or 4 for the
+// half kHz channels of the 12.5 kHz raster.
+// returns a pointer to the terminating zero
+
+char *fmtNumber(char *dst, int32_t value, uint8_t width, uint8_t decimals)
+{
+    char     digits[10];
+    uint8_t  n = 0;         // number of digits to print
+    uint8_t  i;
+    uint8_t  length;
+    char     d;
+    char     negative = (value < 0);
+    uint32_t v = (negative) ? -value : value;
+    uint32_t p;
+
+    for (i=0; i<10; i++)
+    {
+        d = '0';
+        p = pgm_read_dword(&PowersOfTen[i]);
+        while (v >= p)
+        {
+            v -= p;
+            d++;
+        }
+        // skip leading zeros, but keep one digit before the decimal point
+        if (n || (d != '0') || (i >= 9-decimals))
+            digits[n++] = d;
+    }
+    while ((decimals > 3) && (digits[n-1] == '0'))
+    {
+        n--;
+        decimals--;
+    }
+
+    length = n + negative + ((decimals) ? 1 : 0);
+    while (width > length)
+    {
+        *dst++ = ' ';
+        width--;
+    }
+    if (negative)
+        *dst++ = '-';
+    for (i=0; i<n; i++)
+    {
+        if (i == n-decimals)
+            *dst++ = '.';
+        *dst++ = digits[i];
+    }
+    *dst = 0;
+    return dst;
+}
+
+// }}}
+
+// }}}
 // {{{ void OutputSetAudioMute(char mute)
 
 #define MUTEINDICATOR 'M'
@@ -2059,72 +3573,341 @@ void OutputSetAudioMute(char mute)
 
 
 // }}}
-// {{{ void OutputSetVfoFrequency(int32_t vfoFreq)
+// {{{ void PllCounterSet(struct PllCounterStruct *c, int32_t freq)
 
-void OutputSetVfoFrequency(int32_t vfoFreq)
+// full calculation of the counters, needs a 32 bit division
+
+void PllCounterSet(struct PllCounterStruct *c, int32_t freq)
 {
-    static int32_t prevVfo;
-    int32_t reg, frast;
-    int32_t fRasterHigh, fRasterLow;
+    int32_t channel = freq / SS_ChannelStep;
+
+    c->freq = freq;
+    c->b = channel / PLLPRESCALER;
+    c->a = channel % PLLPRESCALER;
+    c->reg = ((uint32_t)(c->b & 0x1fff)<<8) + ((c->a & 0x3f)<<2) + 1;
+}
+
+// }}}
+// {{{ void PllCounterAdd(struct PllCounterStruct *c, int8_t b, int8_t a)
+
+// move the counters by b*PLLPRESCALER + a channels, -PLLPRESCALER < a < PLLPRESCALER
 
-    if (prevVfo != vfoFreq)
+void PllCounterAdd(struct PllCounterStruct *c, int8_t b, int8_t a)
+{
+    c->b += b;
+    c->a += a;
+    if (c->a >= PLLPRESCALER)
+    {
+        c->a -= PLLPRESCALER;
+        c->b++;
+    } else if (c->a < 0)
     {
-        prevVfo = vfoFreq;
-        frast = vfoFreq / CHANNELSTEP;
-        fRasterHigh = frast/16;
-        fRasterLow  = frast%16;
+        c->a += PLLPRESCALER;
+        c->b--;
+    }
+    c->freq += ((int32_t)b * PLLPRESCALER + a) * SS_ChannelStep;
+    c->reg = ((uint32_t)(c->b & 0x1fff)<<8) + ((c->a & 0x3f)<<2) + 1;
+}
+
+// }}}
+// {{{ void PllCounterTrack(struct PllCounterStruct *c, int32_t freq)
 
-        reg = ((fRasterHigh & 0x1fff)<<8) + ((fRasterLow & 0x3f)<<2) + 1;
-        OutputSetPLL(reg);
+// Tuning and scanning move the vfo by one channel or one MHz at a time, the
+// counters then follow with a few additions. Only other jumps (shift,
+// scan wrap) need the full calculation. The one MHz increments depend on
+// the raster and come from ProcSetRaster().
+
+void PllCounterTrack(struct PllCounterStruct *c, int32_t freq)
+{
+    int32_t delta = freq - c->freq;
+
+    if (delta == 0)
+        return;
+    else if (delta == SS_ChannelStep)
+        PllCounterAdd(c, 0, 1);
+    else if (delta == -SS_ChannelStep)
+        PllCounterAdd(c, 0, -1);
+    else if (delta == ONEMHZ)
+        PllCounterAdd(c, pllMHzB, pllMHzA);
+    else if (delta == -ONEMHZ)
+        PllCounterAdd(c, -pllMHzB, -pllMHzA);
+    else
+        PllCounterSet(c, freq);
+}
+
+// }}}
+// {{{ void OutputSetVfoWord(char tx)
+
+// program the ready made receive or transmit N word, when not already done
+// A new frequency drops what the ADC interrupt found on the old one: the
+// carrier event, its squelch opening and the S-meter (no signal until the
+// first filter sample after lock). Until lock it takes no decisions.
+
+void OutputSetVfoWord(char tx)
+{
+    struct PllCounterStruct *c = (tx) ? &pllTx : &pllRx;
+    int32_t  jump = c->freq - pllNFreq;
+    uint32_t reg  = c->reg;
+
+    // fastlock for all but single channel steps while tuning, a word that
+    // is still in fastlock stays there until OutputPllSettle() ends it
+    if ((SS_FastLock != FL_OFF) && (jump != 0) &&
+        (SS_Scanning || (jump > SS_ChannelStep) || (jump < -SS_ChannelStep)))
+        reg |= PLLCPGAIN;
+    if (jump == 0)
+        reg |= pllShadow[PLL_N] & PLLCPGAIN;
+    pllNFreq = c->freq;
+
+    if (jump != 0)
+    {
+        SIMADC();                   // conversions up to here see the old channel
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            IRQ_Retuning    = TRUE;
+            IRQ_Carrier     = FALSE;
+            IRQ_SquelchOpen = FALSE;
+            IRQ_SMeter      = 1023;
+            IRQ_SMeterValid = FALSE;
+            if (SS_Muted)
+                sbi(PORTC, MUTE);
+        }
     }
+
+    PllSet(PLL_N, reg);
+#ifdef TESTING
+    char pending = (pllShadow[PLL_N] != pllChip[PLL_N]);
+#endif
+    PllCommit();
+#ifdef TESTING
+    // key (or test) to latch latency, see 't' and 'r' in InputHandler()
+    if (pending && simPttTime)
+    {
+        pttLatency = (uint32_t)(simMicros - simPttTime);
+        if (pttLatency > pttLatencyMax) pttLatencyMax = pttLatency;
+        simPttTime = 0;
+    }
+#endif
 }
 
 // }}}
 // {{{ void OutputSetPLLReference(int32_t reference)
 
+// R-counter for the reference frequency, the phase detector runs at the
+// channel step. Only recalculated when the reference or the raster changed.
+
 void OutputSetPLLReference(int32_t reference)
 {   
-    int32_t reg;
-    // init R-counter
-    reg = (2UL<<16) + ((SS_PllReferenceFrequency/CHANNELSTEP)<<2);
-    OutputSetPLL(reg);
+    static int32_t prevReference;
+    static int32_t prevStep;
+
+    if ((reference != prevReference) || (SS_ChannelStep != prevStep))
+    {
+        prevReference = reference;
+        prevStep      = SS_ChannelStep;
+        PllSet(PLL_R, (2UL<<16) + ((reference/SS_ChannelStep)<<2));
+    }
+}
+
+// }}}
+// {{{ uint32_t PllFunctionWord(int8_t fastlock)
+
+uint32_t PllFunctionWord(int8_t fastlock)
+{
+    uint32_t word = PLLFUNCTION | ((uint32_t)PLLCPFAST << 18);
+
+    if (fastlock == FL_SOFT)
+        word |= PLLFASTLOCK;
+    else if (fastlock >= FL_TIMEOUT)
+        word |= PLLFASTLOCK | PLLFLTIMER | ((uint32_t)(fastlock - FL_TIMEOUT) << 11);
+    return word;
+}
+
+// }}}
+// {{{ void PllSet(uint8_t latch, uint32_t word)
+
+void PllSet(uint8_t latch, uint32_t word)
+{
+    pllShadow[latch] = word;
+}
+
+// }}}
+// {{{ void PllCommit(void)
+
+// Shift out the latches that differ from what the PLL holds, in the order
+// the datasheet wants them: init, function, R, N.
+
+const uint8_t PllCommitOrder[PLLLATCHES] = { PLL_INIT, PLL_FUNC, PLL_R, PLL_N };
+
+void PllCommit(void)
+{
+    uint8_t i, latch;
+
+    for (i=0; i<PLLLATCHES; i++)
+    {
+        latch = PllCommitOrder[i];
+        if (pllShadow[latch] != pllChip[latch])
+        {
+            OutputSetPLL(pllShadow[latch]);
+            pllChip[latch] = pllShadow[latch];
+            if ((latch == PLL_R) || (latch == PLL_N))
+            {
+                pllSettling = TRUE;
+#ifdef TESTING
+                simPllLockAt = simMicros + SIMPLLLOCK;
+#endif
+            }
+        }
+    }
+}
+
+// }}}
+// {{{ char PllLocked(void)
+
+char PllLocked(void)
+{
+#ifdef TESTING
+    return !simPllFault && (simMicros >= simPllLockAt);
+#else
+    return (PIND & _BV(PLL_LOCK)) != 0;
+#endif
+}
+
+// }}}
+// {{{ char PllWaitLock(uint16_t timeout)
+
+// wait at most "timeout" us for the PLL to lock, returns TRUE when locked
+
+char PllWaitLock(uint16_t timeout)
+{
+    while (!PllLocked())
+    {
+        if (timeout < PLLLOCKPOLL)
+            return FALSE;
+        _delay_us(PLLLOCKPOLL);
+        timeout -= PLLLOCKPOLL;
+    }
+    return TRUE;
 }
 
 // }}}
 // {{{ void OutputSetPLL(int32_t r)
 
+// Shifts one 24 bit word into the ADF4113, msb first. The chip needs only
+// tens of ns per clock phase, so there are no delays and no loop. Each bit
+// is two writes of the whole port: the data with the clock low, then the
+// same with the clock high (the chip takes the data on the rising edge).
+// The data bit is shifted into place, not tested, so a 0 and a 1 bit take
+// the same cycles and every word takes the same time.
+// The word and the latch pulse run with interrupts off, which also keeps
+// the port writes from undoing a MUTE change of the ADC interrupt. That is
+// about 200 cycles, 200 us at 1 MHz, the longest any interrupt waits for
+// it: well within an ADC conversion (1664 us) or the 2 ms half period of
+// the highest CTCSS tone. Define PLL_BENCHMARK to have the real number
+// shown at startup.
+
+#define PLLBIT(v, n) \
+    data = port | ((((v) >> (n)) & 1) << ADATA); \
+    PORTC = data; \
+    SIMPLLBUS(); \
+    PORTC = data | _BV(ACLK); \
+    SIMPLLBUS()
+
+#define PLLBYTE(v) \
+    PLLBIT(v, 7); PLLBIT(v, 6); PLLBIT(v, 5); PLLBIT(v, 4); \
+    PLLBIT(v, 3); PLLBIT(v, 2); PLLBIT(v, 1); PLLBIT(v, 0)
+
 void OutputSetPLL(int32_t r)
 {
-    char i;
+    uint8_t high = (uint8_t)(r >> 16);
+    uint8_t mid  = (uint8_t)(r >> 8);
+    uint8_t low  = (uint8_t)r;
+    uint8_t port, data;
+#ifdef TESTING
+    simCharge(SC_PLL, SIMPLLWORD);
+    pllWrites++;
+#endif
 
-    for (i=0; i<24; i++) 
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        if (r & 0x800000)
-            sbi(PORTC, ADATA);
-        else
-            cbi(PORTC, ADATA);
+        port = PORTC & ~(_BV(ADATA) | _BV(ACLK) | _BV(ALE));
+        PLLBYTE(high);
+        PLLBYTE(mid);
+        PLLBYTE(low);
+        PORTC = port;
+        SIMPLLBUS();
+
+        // activate the latch
+        PORTC = port | _BV(ALE);
+        SIMPLLBUS();
+        PORTC = port;
+        SIMPLLBUS();
+    }
+}
+
+// }}}
+// {{{ void PllBenchmark(void)
+#ifdef PLL_BENCHMARK
+
+// Times PLLBENCHRUNS writes with timer 1 (F_CPU clock) and shows min and
+// max cycles per word. The N words alternate between no 1 bits, all 1 bits
+// and the current word, which is programmed again at the end. A word runs
+// with interrupts off, so the max is also the longest interrupt delay.
 
-        // output the int32_t word via bit banging
-        _delay_us(1);
-        sbi(PORTC, ACLK);
-        _delay_us(1);
-        cbi(PORTC, ACLK);
-        r <<= 1;
+void PllBenchmark(void)
+{
+    uint32_t word;
+    uint16_t t0, t1, empty, cycles;
+    uint16_t min = 0xFFFF, max = 0;
+    uint8_t  i;
+    char     *p;
+
+    // what reading the timer twice costs by itself
+    ATOMIC_BLOCK(ATOMIC_FORCEON)
+    {
+        t0 = TCNT1;
+        t1 = TCNT1;
     }
+    empty = t1 - t0;
 
-    // activate the latch
-    _delay_us(1);
-    sbi(PORTC, ALE);
-    _delay_us(1);
-    cbi(PORTC, ALE);
+    for (i=0; i<PLLBENCHRUNS; i++)
+    {
+        word = (i % 3 == 0) ? PLL_N : (i % 3 == 1) ? (0xFFFFFCUL | PLL_N) : pllChip[PLL_N];
+        ATOMIC_BLOCK(ATOMIC_FORCEON)
+        {
+            t0 = TCNT1;
+            OutputSetPLL(word);
+            t1 = TCNT1;
+        }
+        // timer 1 restarted in between, try again
+        if (t1 < t0)
+        {
+            i--;
+            continue;
+        }
+        cycles = t1 - t0 - empty;
+        if (cycles < min) min = cycles;
+        if (cycles > max) max = cycles;
+    }
+    OutputSetPLL(pllChip[PLL_N]);
+
+    p = fmtText(LineB, "PLL ", 0);
+    p = fmtNumber(p, min, 3, 0);
+    p = fmtText(p, "-", 0);
+    p = fmtNumber(p, max, 3, 0);
+    fmtText(p, " cyc", 0);
+    lcdFrameStr(1, LineB);
+    lcdFlush();
+    lcdQueueFlush();
+    _delay_ms(3000);
 }
 
+#endif
 // }}}
 // {{{ void OutputSetCtcssFreq(int ctcssFreq) 
 
 void OutputSetCtcssFreq(int ctcssFreq)
 {
-    TimerValue = 5*F_CPU/SS_CtcssFrequency; // *10/2
+    TimerValue = (SS_CtcssFrequency) ? 5*F_CPU/SS_CtcssFrequency : 0xFFFF; // *10/2, no tone: slowest tick
 }
 
 // }}}
@@ -2154,110 +3937,146 @@ void OutputSetDisplayFrequency(int32_t freq)
     if (prevFreq != freq)
     {
         prevFreq = freq;
-#ifdef TESTING
-        sprintf(LineT, "VFO %4u.%03u MHz", freq/1000, freq%1000);
-#else
-        sprintf(LineT, "VFO %4lu.%03lu MHz", freq/1000, freq%1000);
-#endif
-
-#ifdef TESTING
-        // set color to blue
-        printf("\033[34m");
-#endif
-        lcdHome();
-        lcdStr16(LineT);
-#ifdef TESTING
-        // reset color to black
-        printf("\033[30m");
-#endif
+        // "VFO 1298.200 MHz" or "VFO 1298.2125MHz"
+        char *p = fmtText(LineT, "VFO ", 0);
+        p = fmtNumber(p, freq, 8, 6);
+        fmtText(p, (p - LineT > 12) ? "MHz" : " MHz", 0);
+        lcdFrameStr(0, LineT);
     }
 }
 
 // }}}
 // {{{ void OutputSetDisplaySMeter(uint16_t sValue)
 
-void OutputSetDisplaySMeter(uint16_t sValue)
+#define MaxSMeter 39
+
+// first position is for the Mute indicator
+// last position is for the TxRx indicator
+// last but one position is for the Tune indicator
+// which leaves the (displaywidth - 3) for the S-Meter
+// every cell shows 3 levels (lines), that is one S-unit: S1 .. S9+24 dB
+#define SMETERCELLS     (DISPLAY_WIDTH-3)
+
+// {{{ char SMeterCellChar(uint8_t cell, uint8_t level, uint8_t peak)
+
+char SMeterCellChar(uint8_t cell, uint8_t level, uint8_t peak)
 {
-#ifdef TESTING
-#define C0  '.'
-#define C1  '\''
-#define C2  '"'
+    uint8_t base = cell*3;  // levels shown left of this cell
+
+    if (level >= base+3) return lcdGlyph(GL_BAR3);
+    if (level == base+2) return lcdGlyph(GL_BAR2);
+    if (level == base+1) return lcdGlyph(GL_BAR1);
+    // empty cell, it may hold the peak marker
+    if ((peak > base) && (peak <= base+3)) return lcdGlyph(GL_PEAK);
+    return ' ';
+}
+
+// }}}
+// {{{ uint8_t SMeterPeak(uint8_t level)
+
+// peak hold: the marker stays SMETERPEAKHOLD centiseconds at the highest
+// level, then falls back one level every SMETERPEAKDECAY centiseconds
+
+uint8_t SMeterPeak(uint8_t level)
+{
+#if SMETERPEAKHOLD
+    static uint8_t  peak;
+    static uint32_t peakTime;
+    uint32_t now = sysClock();
+
+    if (level >= peak)
+    {
+        peak = level;
+        peakTime = now;
+    } else if ((now - peakTime) > SMETERPEAKHOLD)
+    {
+        peak--;
+        peakTime += SMETERPEAKDECAY;
+    }
+    return peak;
 #else
-#define C0  0
-#define C1  1
-#define C2  2
+    return 0;
 #endif
-#define MaxSMeter 39
+}
+
+// }}}
+
+// Only the cells between the previous and the new level are rewritten,
+// plus the cells of the previous and the new peak marker.
+// SMeterLevel is set to SMETERUNKNOWN when something else has used
+// the bottom line, that forces a full redraw.
+
+void OutputSetDisplaySMeter(uint16_t sValue)
+{
+    uint8_t level;
+    uint8_t peak;
+    uint8_t lo, hi;
+    uint8_t i;
 
     if (sValue > MaxSMeter) sValue = MaxSMeter;
-    // first position is for the Mute indicator
-    // last position is for the TxRx indicator
-    // last but one position is for the Tune indicator
-    // which leaves the (displaywidth - 3) for the S-Meter
-    int8_t n = DISPLAY_WIDTH-3;
+    level = sValue;
+    peak  = SMeterPeak(level);
 
-    lcdCursorPosition(1,1); // goto second line
+    if ((level == SMeterLevel) && (peak == SMeterPeakLevel))
+        return;
 
-    // characters in the full bar are 3 lines
-    while ((sValue >= 3) & (n>0))
+    if (SMeterLevel == SMETERUNKNOWN)
     {
-        // write character 3 (3 lines)
-        lcdData(C2);
-        sValue -= 3;
-        n--;
-    }
-
-    // last char 0, 1 or 2 lines
-    switch (sValue) 
+        lo = 0;
+        hi = SMETERCELLS-1;
+    } else
     {
-        case 2 : lcdData(C1); 
-                 break;
-        case 1 : lcdData(C0); 
-                 break;
-                 // default: // nothing to print
+        // cells that change because of the bar itself
+        lo = ((level < SMeterLevel) ? level : SMeterLevel) / 3;
+        hi = ((level > SMeterLevel) ? level : SMeterLevel) / 3;
+        if (hi > SMETERCELLS-1) hi = SMETERCELLS-1;
+
+        // old peak marker cell
+        if (SMeterPeakLevel)
+        {
+            i = (SMeterPeakLevel-1) / 3;
+            lcdFramePut(1, 1+i, SMeterCellChar(i, level, peak));
+        }
     }
 
-    // clear any remaining characters to the right
-    while (--n > 0) 
+    for (i=lo; i<=hi; i++)
+        lcdFramePut(1, 1+i, SMeterCellChar(i, level, peak));
+
+    // new peak marker cell
+    if (peak)
     {
-        lcdData(' ');
+        i = (peak-1) / 3;
+        lcdFramePut(1, 1+i, SMeterCellChar(i, level, peak));
     }
+
+    SMeterLevel     = level;
+    SMeterPeakLevel = peak;
 }
 
 // }}}
 // {{{ void OutputSetDisplayTxRxIndicator(char indicator)
 
-// only write to the (slow) display if the indicator
-// really should be updated
+// the frame buffer takes care of only sending changed
+// characters to the (slow) display
 
 void OutputSetDisplayTxRxIndicator(char indicator)
 {
-    static char prevIndicator;
-
-    if (prevIndicator != indicator)
+    switch (indicator)
     {
-        prevIndicator = indicator;
-        lcdCursorPosition(1, DISPLAY_WIDTH-1);
-        lcdData(indicator);
+        case 'T' : indicator = lcdGlyph(GL_TX);
+                   break;
+        case 'R' : indicator = lcdGlyph(GL_RX);
+                   break;
     }
+    lcdFramePut(1, DISPLAY_WIDTH-1, indicator);
 }
 
 // }}}
 // {{{ void OutputSetDisplayTuneIndicator(char indicator)
 
-// only write to the (slow) display if the indicator
-// really should be updated
-
 void OutputSetDisplayTuneIndicator(char indicator)
 {
-    static char prevIndicator;
-
-    if (prevIndicator != indicator)
-    {
-        prevIndicator = indicator;
-        lcdCursorPosition(1, DISPLAY_WIDTH-2);
-        lcdData(indicator);
-    }
+    lcdFramePut(1, DISPLAY_WIDTH-2, indicator);
 }
 
 // }}}
@@ -2267,8 +4086,7 @@ void OutputSetDisplayMuteIndicator(char indicator)
 {
     if (SS_Tuning)
     {
-        lcdCursorPosition(1,0);  // bottom row, first column;
-        lcdData(indicator); 
+        lcdFramePut(1, 0, indicator);  // bottom row, first column;
     }
 } 
 
@@ -2278,19 +4096,10 @@ void OutputSetDisplayMuteIndicator(char indicator)
 
 void TopLinePrinter(uint16_t ix)
 {
-    static char prevLine[DISPLAY_WIDTH+10];
-
     char *prompt = (SS_ValueEdit) ? "  " : "> ";
 
-    sprintf(LineT,"%s%-14s", prompt, theMenu[ix].name);
-
-    // only send to display when something actually changed 
-    if (strcmp(LineT,prevLine) != 0)
-    {
-        lcdHome();
-        lcdStr(LineT);
-        strcpy(prevLine,LineT);
-    } 
+    fmtText(fmtText(LineT, prompt, 0), theMenu[ix].name, DISPLAY_WIDTH-2);
+    lcdFrameStr(0, LineT);
 }
 
 // }}}
@@ -2298,31 +4107,24 @@ void TopLinePrinter(uint16_t ix)
 
 void BottomLinePrinter(uint16_t ix)
 {
-    static char prevLine[DISPLAY_WIDTH+10];
     int32_t val;
-    int8_t slength = -1;
-    uint8_t i;
     char *prompt = (SS_ValueEdit) ? "> " : "  ";
-    char *valStr;
+    char *valStr = NULL;
+    char *p = LineB;
+    char chanStr[DISPLAY_WIDTH+1];
+    char *q;
+    struct FormatStruct *fmt = &theMenu[ix].format;
     val = theMenu[ix].value;
 
-
+    // translate the menu value into what should be shown
     switch (ix)
     {
-        case MMUTELEVEL :
-            slength = sprintf(LineB, theMenu[ix].format, prompt, val);
-            break;
-        case MSSTART :
-        case MSEND :
-            slength = sprintf(LineB, theMenu[ix].format, prompt, val/1000, val%1000);
-            break;
-
         case MCTCSS :
-            slength = sprintf(LineB, theMenu[ix].format, prompt, CtcssTones[val]/10, CtcssTones[val]%10);
+            val = CtcssTones[val];
             break;
 
         case MABAUDRATE :
-            slength = sprintf(LineB, theMenu[ix].format, prompt, Baudrates[val]);
+            val = Baudrates[val];
             break;
 
         case MAROTARYTYPE :
@@ -2330,66 +4132,320 @@ void BottomLinePrinter(uint16_t ix)
                 valStr = "Step per pulse";
             else
                 valStr = "Step per cycle";
-            slength = sprintf(LineB, theMenu[ix].format, prompt, valStr);
             break;
 
         case MARETURNMODE :
-            slength = sprintf(LineB, theMenu[ix].format, prompt, (SS_DirectMenuReturn) ? "to tuning" : "to menu");
+            valStr = (SS_DirectMenuReturn) ? "to tuning" : "to menu";
             break;
 
         case MAFRONTENABLE :
         case MAREMOTEENABLE :
-            slength = sprintf(LineB, theMenu[ix].format, prompt, (val) ? "Enabled" : "Disabled");
+            valStr = (val) ? "Enabled" : "Disabled";
             break;
 
-        case MSHIFT :
-        case MAPLLREFMHZ :
-        case MAPLLREFKHZ :
-            slength = sprintf(LineB, theMenu[ix].format, prompt, val/1000, val%1000);
+        case MSQAUTO :
+            valStr = (val) ? "Noise floor" : "Fixed level";
+            break;
+
+        case MSCSAVE :
+            q = fmtNumber(fmtText(chanStr, "Ch", 0), val, 3, 0);
+            if (memory[val-1].frequency)
+                fmtNumber(fmtText(q, " ", 0), memory[val-1].frequency, 8, 6);
+            else
+                fmtText(q, " empty", 0);
+            valStr = chanStr;
+            break;
+
+        // while editing show the ADC value a select would record
+        case MSMCALLOW :
+        case MSMCALHIGH :
+            if (SS_ValueEdit && !SMeterOnSlope(SS_SMeterIn))
+                valStr = "Out of range";
+            else if (SS_ValueEdit)
+                val = SS_SMeterIn;
+            else if (!val)
+                valStr = "Not set";
+            break;
+
+        case MARASTER :
+            valStr = RasterNames[val];
+            break;
+
+        case MAFASTLOCK :
+            if (val == FL_OFF)
+                valStr = "Off";
+            else if (val == FL_SOFT)
+                valStr = "Until locked";
+            else
+                val = 3 + 4*(val - FL_TIMEOUT);     // timeout in PFD cycles
             break;
+    }
 
-        default:
-            slength = 0;
+    if (valStr)
+    {
+        p = fmtText(p, prompt, 0);
+        p = fmtText(p, valStr, 0);
+    } else if (fmt->width)
+    {
+        p = fmtText(p, prompt, 0);
+        p = fmtNumber(p, val, fmt->width, fmt->decimals);
+        p = fmtText(p, fmt->unit, 0);
     }
-    if (slength > -1)
+    // clear rest of line
+    if ((p - LineB) < DISPLAY_WIDTH)
+        fmtText(p, "", DISPLAY_WIDTH - (p - LineB));
+
+    lcdFrameStr(1, LineB);
+}
+
+// }}}
+
+// {{{ Display control routines
+
+// {{{ LCD transmit queue
+
+// lcdCmd() and lcdData() do not wait for the display controller, they put
+// the byte in a ring buffer and return right away. The timer 2 interrupt
+// takes one entry from the queue every LCDTICK us and sends it to the
+// display. A LQ_WAIT entry makes the interrupt skip a number of ticks, for
+// the slow commands (clear, home). With the global interrupts still off
+// (during initialisation) the queue is serviced from the foreground.
+
+#ifndef TESTING
+
+volatile uint8_t lcdQueueType[LCDQUEUESIZE];
+volatile uint8_t lcdQueueValue[LCDQUEUESIZE];
+volatile uint8_t lcdQueueHead;      // next free entry, only written by lcdQueuePut()
+volatile uint8_t lcdQueueTail;      // next entry to send, only written by lcdQueueService()
+volatile uint8_t lcdQueueDelay;     // ticks to wait before sending the next entry
+
+#define lcdQueueEmpty()     (lcdQueueHead == lcdQueueTail)
+#define lcdQueueFull()      (((lcdQueueHead+1) & (LCDQUEUESIZE-1)) == lcdQueueTail)
+#define lcdInterruptsOn()   ((SREG & 0x80) != 0)
+
+// {{{ char lcdBusy(void)
+
+// Read the busy flag. Only possible with PB2 wired to R/W, without
+// that wire the controller is assumed to be ready after every tick.
+
+char lcdBusy(void)
+{
+#ifdef LCD_BUSYFLAG
+    char busy;
+
+    // data lines to input, RS=0 RW=1: read status
+    DDRB  &= 0x0F;
+    PORTB  = (PORTB & _BV(Beep)) | (1<<LCD_RW);
+    sbi(PORTB, LCD_E);
+    _delay_us(1);
+    busy = (PINB & (1<<LCD_D7)) != 0;
+    cbi(PORTB, LCD_E);
+
+    // in 4 bit mode the low nibble has to be clocked out as well
+    sbi(PORTB, LCD_E);
+    _delay_us(1);
+    cbi(PORTB, LCD_E);
+
+    // back to writing
+    cbi(PORTB, LCD_RW);
+    DDRB  |= 0xF0;
+    return busy;
+#else
+    return FALSE;
+#endif
+}
+
+// }}}
+// {{{ void lcdWaitReady(void)
+
+void lcdWaitReady(void)
+{
+#ifdef LCD_BUSYFLAG
+    uint8_t polls = LCDBUSYPOLLS;
+    while (lcdBusy() && --polls);
+#else
+    _delay_us(LCDTICK);
+#endif
+}
+
+// }}}
+// {{{ void lcdQueueService(void)
+
+// Sends at most one queue entry. This is the body of the timer 2 interrupt,
+// inlined there so the interrupt saves no registers for a call; keep it short.
+
+static inline __attribute__((always_inline)) void lcdQueueService(void)
+{
+    uint8_t type;
+    uint8_t value;
+
+    if (lcdQueueDelay)
     {
-        for (i=slength; i<=DISPLAY_WIDTH; i++)
-            LineB[i] = ' ';                  // clear rest of line
-        LineB[i] = (uint8_t)0;               // set string terminator
+        lcdQueueDelay--;
+        return;
     }
 
-    // only send to display when something actually changed 
-    if (strcmp(LineB,prevLine) != 0)
+    if (lcdQueueEmpty())
     {
-        // goto bottom line
-        lcdCursorPosition(1,0);
-        lcdStr(LineB);
-        strcpy(prevLine,LineB);
-    } 
+        // nothing to do, stop the tick until lcdQueuePut() needs it again
+        TIMSK2 &= ~_BV(OCIE2A);
+        return;
+    }
 
+#ifdef LCD_BUSYFLAG
+    // send entries as long as the controller is ready for them
+    uint8_t n = LCDBURST;
+    while (n-- && !lcdQueueEmpty() && !lcdBusy())
+#endif
+    {
+        type  = lcdQueueType [lcdQueueTail];
+        value = lcdQueueValue[lcdQueueTail];
+        lcdQueueTail = (lcdQueueTail+1) & (LCDQUEUESIZE-1);
+
+        switch (type)
+        {
+            case LQ_NIB :
+                lcdNib(value);
+                break;
+
+            case LQ_CMD :
+                lcdNib(value & 0xF0);
+                lcdNib(value << 4);
+                break;
+
+            case LQ_DATA :
+                lcdNib((value & 0xF0) | (1<<LCD_RS));
+                lcdNib((value << 4)   | (1<<LCD_RS));
+                break;
+
+            case LQ_WAIT :
+                lcdQueueDelay = value;
+                break;
+        }
+    }
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+    lcdQueueService();
 }
 
 // }}}
+// {{{ void lcdQueuePut(uint8_t type, uint8_t value)
 
-// {{{ Display control routines
+void lcdQueuePut(uint8_t type, uint8_t value)
+{
+    // wait for room in the queue
+    while (lcdQueueFull())
+    {
+        if (!lcdInterruptsOn())
+        {
+            lcdQueueService();
+            lcdWaitReady();
+        }
+    }
 
-// {{{ void lcdNib(char c)
+    lcdQueueType [lcdQueueHead] = type;
+    lcdQueueValue[lcdQueueHead] = value;
+    lcdQueueHead = (lcdQueueHead+1) & (LCDQUEUESIZE-1);
+
+    // (re)start the tick
+    TIMSK2 |= _BV(OCIE2A);
+}
+
+// }}}
+
+#endif
+
+// {{{ void lcdQueueFlush(void)
 
-void lcdNib(char nibble)
+// wait until everything in the queue has reached the display
+
+void lcdQueueFlush(void)
 {
-#if FALSE // for debugging
-    unsigned char bcpy;
-    bcpy = PORTB & 0x0C;    // clear high nibble
-    nibble = nibble & 0xF3; // clear low nibble
-    nibble = nibble + bcpy; // combine log nibble of PORTB with high nibble of NIBBLE
-    // nibble now containts the content of nibble + the original 4 low bits of PORTB
+#ifndef TESTING
+    while (!lcdQueueEmpty() || lcdQueueDelay)
+    {
+        if (!lcdInterruptsOn())
+        {
+            lcdQueueService();
+            lcdWaitReady();
+        }
+    }
 #endif
+}
+
+// }}}
+// {{{ void LcdBenchmark(void)
+#ifdef LCD_BENCHMARK
+
+// Times LCDBENCHRUNS queue entries sent by lcdQueueService() with timer 1
+// (F_CPU clock) and shows min and max cycles per entry. The entries are
+// cursor moves to the top left, they change nothing on the display. The
+// interrupt entry and exit add some 30 cycles to one tick.
 
-    PORTB = nibble;
+void LcdBenchmark(void)
+{
+    uint16_t t0, t1, empty, cycles;
+    uint16_t min = 0xFFFF, max = 0;
+    uint8_t  i;
+    char     *p;
+
+    // what reading the timer twice costs by itself
+    lcdQueueFlush();
+    ATOMIC_BLOCK(ATOMIC_FORCEON)
+    {
+        t0 = TCNT1;
+        t1 = TCNT1;
+    }
+    empty = t1 - t0;
+
+    for (i=0; i<LCDBENCHRUNS; i++)
+    {
+        ATOMIC_BLOCK(ATOMIC_FORCEON)
+        {
+            lcdQueuePut(LQ_CMD, dispDDRA);
+            t0 = TCNT1;
+            lcdQueueService();
+            t1 = TCNT1;
+        }
+        // timer 1 restarted in between, try again
+        if (t1 < t0)
+        {
+            i--;
+            continue;
+        }
+        cycles = t1 - t0 - empty;
+        if (cycles < min) min = cycles;
+        if (cycles > max) max = cycles;
+        _delay_us(LCDTICK);
+    }
+
+    p = fmtText(LineB, "LCD ", 0);
+    p = fmtNumber(p, min, 3, 0);
+    p = fmtText(p, "-", 0);
+    p = fmtNumber(p, max, 3, 0);
+    fmtText(p, " cyc", 0);
+    lcdFrameStr(1, LineB);
+    lcdFlush();
+    lcdQueueFlush();
+    _delay_ms(3000);
+}
+
+#endif
+// }}}
+
+// }}}
+// {{{ void lcdNib(char c)
+
+static inline void lcdNib(char nibble)
+{
+    // keep the CTCSS tone output, R/W (PB2) is low: write
+    // no settle delay here, the queue tick paces the display writes
+    PORTB = (PORTB & _BV(Beep)) | (nibble & ~_BV(LCD_RW));
     sbi(PORTB, LCD_E);
     _delay_us(2);
     cbi(PORTB, LCD_E);
-    _delay_us(200);
 }
 
 // }}}
@@ -2398,10 +4454,12 @@ void lcdNib(char nibble)
 void lcdCmd(char c)
 {
 #ifdef TESTING
-    deCmd(c);
+    simCharge(SC_LCD, SIMLCDBYTE);
+    simLcdCmds++;
+    if (!Headless)
+        deCmd(c);
 #else
-    lcdNib(c & 0xF0);
-    lcdNib(c << 4);
+    lcdQueuePut(LQ_CMD, c);
 #endif
 }
 
@@ -2412,10 +4470,15 @@ void lcdCmd(char c)
 void lcdHome(void)
 {
 #ifdef TESTING
-    deTop();
+    simCharge(SC_LCD, SIMLCDBYTE);
+    simLcdCmds++;
+    if (!Headless)
+        deTop();
 #else
     lcdCmd(dispHOME);
-    _delay_ms(20);
+#ifndef LCD_BUSYFLAG
+    lcdQueuePut(LQ_WAIT, LCDSLOWTICKS);
+#endif
 #endif
 }
 
@@ -2425,19 +4488,14 @@ void lcdHome(void)
 void lcdData(char c)
 {
 #ifdef TESTING
+    simCharge(SC_LCD, SIMLCDBYTE);
+    if (Headless)
+        return;
     // set color to blue
-    printf("\033[34m");
+    ttySetColor(34);
     deData(c);
 #else
-    char t;
-
-    t = c & 0xf0;   
-    t |= (1<<LCD_RS);   
-    lcdNib(t);
-
-    c <<= 4;
-    c |= (1<<LCD_RS);   
-    lcdNib(c);
+    lcdQueuePut(LQ_DATA, c);
 #endif
 }
 
@@ -2463,7 +4521,7 @@ void lcdStr16(char *s)
     for (i=0; i<DISPLAY_WIDTH; i++)
         lcdData(*s++);
 #ifdef TESTING
-    printf("\n");
+    ttyPrintf("\n");
 #endif
 }
 
@@ -2492,16 +4550,220 @@ void lcdCursorPosition(int row, int column)
 }
 
 // }}}}
+// {{{ Frame buffer
+
+// All output routines write into lcdFrame. lcdFlush() compares it with
+// lcdDdram and only sends the characters that actually changed. A run of
+// changed characters costs a single cursor positioning command, as the
+// display controller auto-increments the address after each data write.
+
+// {{{ void lcdFrameInit(void)
+
+void lcdFrameInit(void)
+{
+    // after a clear command the display controller holds spaces
+    memset(lcdFrame, ' ', sizeof(lcdFrame));
+    memset(lcdDdram, ' ', sizeof(lcdDdram));
+}
+
+// }}}
+// {{{ void lcdFramePut(uint8_t row, uint8_t col, char c)
+
+void lcdFramePut(uint8_t row, uint8_t col, char c)
+{
+    if ((row < DISPLAY_HEIGHT) && (col < DISPLAY_WIDTH))
+        lcdFrame[row][col] = c;
+}
+
+// }}}
+// {{{ void lcdFrameStr(uint8_t row, char *s)
+
+// copy a string into a frame row, pad with spaces when it is short
+
+void lcdFrameStr(uint8_t row, char *s)
+{
+    uint8_t i;
+    for (i=0; i<DISPLAY_WIDTH; i++)
+    {
+        lcdFramePut(row, i, (*s) ? *s++ : ' ');
+    }
+}
+
+// }}}
+// {{{ void lcdFlush(void)
+
+void lcdFlush(void)
+{
+    uint8_t row, col;
+    char    inRun;      // boolean: display address already points at this cell
+
+    for (row=0; row<DISPLAY_HEIGHT; row++)
+    {
+        inRun = FALSE;
+        for (col=0; col<DISPLAY_WIDTH; col++)
+        {
+            if (lcdFrame[row][col] != lcdDdram[row][col])
+            {
+                if (!inRun)
+                {
+                    lcdCursorPosition(row, col);
+                    inRun = TRUE;
+                }
+                lcdData(lcdFrame[row][col]);
+                lcdDdram[row][col] = lcdFrame[row][col];
+            } else
+                inRun = FALSE;
+        }
+    }
+}
+
+// }}}
+
+// }}}
+// {{{ CGRAM glyph cache
+
+// There are more glyphs than CGRAM slots. lcdGlyph() returns the character
+// code of the slot that holds a glyph and only uploads the bitmap when the
+// glyph is not resident yet. When all slots are taken the least recently
+// used glyph that is not on the display (nor in the frame) is replaced;
+// replacing a visible one would change the characters already shown.
+
+// {{{ void lcdGlyphInit(void)
+
+void lcdGlyphInit(void)
+{
+    // CGRAM content is undefined after power up
+    memset(glyphSlot, GL_NONE, sizeof(glyphSlot));
+}
+
+// }}}
+// {{{ char lcdGlyphVisible(uint8_t slot)
+
+char lcdGlyphVisible(uint8_t slot)
+{
+    uint8_t i;
+    for (i=0; i<sizeof(lcdFrame); i++)
+    {
+        if ((((char *)lcdFrame)[i] == slot) || (((char *)lcdDdram)[i] == slot))
+            return TRUE;
+    }
+    return FALSE;
+}
+
 // }}}
+// {{{ char lcdGlyph(uint8_t id)
 
+char lcdGlyph(uint8_t id)
+{
+    uint8_t slot;
+    uint8_t victim = GL_NONE;
+    uint8_t j;
+
+    glyphClock++;
+    for (slot=0; slot<GLYPHSLOTS; slot++)
+    {
+        if (glyphSlot[slot] == id)
+        {
+            glyphUsed[slot] = glyphClock;
+            glyphHits++;
+            return slot;
+        }
+    }
+
+    // not resident: take an empty slot or the least recently used one
+    for (slot=0; slot<GLYPHSLOTS; slot++)
+    {
+        if (glyphSlot[slot] == GL_NONE)
+        {
+            victim = slot;
+            break;
+        }
+        if (!lcdGlyphVisible(slot))
+        {
+            if ((victim == GL_NONE) ||
+                ((uint16_t)(glyphClock - glyphUsed[slot]) > (uint16_t)(glyphClock - glyphUsed[victim])))
+                victim = slot;
+        }
+    }
+
+    // every slot is on the display
+    if (victim == GL_NONE)
+        return GlyphText[id];
+
+    lcdCmd(dispCGRA + (victim << 3));
+    for (j=0; j<8; j++)
+        lcdData(pgm_read_byte(&Glyphs[id][j]));
+    // the next lcdFlush() starts with a cursor command, which
+    // switches the controller back to DDRAM addressing
+
+    glyphSlot[victim] = id;
+    glyphUsed[victim] = glyphClock;
+    glyphLoads++;
+    return victim;
+}
+
+// }}}
+// {{{ uint8_t lcdGlyphUsage(void)
+
+// number of CGRAM slots in use
+
+uint8_t lcdGlyphUsage(void)
+{
+    uint8_t slot;
+    uint8_t n = 0;
+    for (slot=0; slot<GLYPHSLOTS; slot++)
+    {
+        if (glyphSlot[slot] != GL_NONE)
+            n++;
+    }
+    return n;
+}
+
+// }}}
+
+// }}}
+// }}}
+
+// {{{ void OutputPllSettle(void)
+
+// After a new R or N word wait for lock, otherwise just look at the lock
+// detect. A settle timeout or a lost lock counts as one unlock event.
+// Once locked, a fastlock started by OutputSetVfoWord() is ended and the
+// ADC interrupt gets going on the new frequency. After a settle timeout it
+// gets going too: an unlocked receiver is flagged, not muted for good.
+
+void OutputPllSettle(void)
+{
+    char locked;
+
+    locked = (pllSettling) ? PllWaitLock(PLLLOCKTIMEOUT) : PllLocked();
+    if (!locked && (SS_PllLocked || pllSettling))
+        SS_PllUnlocks++;
+
+    // fastlock done: back to the low noise charge pump current
+    if (locked && (pllChip[PLL_N] & PLLCPGAIN))
+    {
+        PllSet(PLL_N, pllChip[PLL_N] & ~PLLCPGAIN);
+        if (SS_FastLock == FL_SOFT)
+            PllCommit();                        // same counters, nothing to settle
+        else
+            pllChip[PLL_N] = pllShadow[PLL_N];  // the timeout counter cleared the bit
+    }
+    if ((locked || pllSettling) && IRQ_Retuning)
+    {
+        SIMADC();                               // conversions up to lock are dropped
+        IRQ_Retuning = FALSE;
+    }
+    pllSettling  = FALSE;
+    SS_PllLocked = locked;
+}
+
+// }}}
 // {{{ void OutputHandler(void)
 
 void OutputHandler(void)
 {
-#ifdef TESTING
-    deFrame();
-#endif
-
+    SIMSTAGE(ST_OUTPUT);
     OutputSetCtcssFreq(SS_CtcssFrequency);
     OutputSetAudioMute(SS_Muted);
 
@@ -2510,7 +4772,7 @@ void OutputHandler(void)
         OutputSetDisplayFrequency(SS_DisplayFrequency);
         OutputSetDisplaySMeter(SS_DisplaySMeter);
         OutputSetDisplayTxRxIndicator(SS_TxRxIndicator);
-        OutputSetDisplayTuneIndicator(SS_TuneIndicator);
+        OutputSetDisplayTuneIndicator((SS_PllLocked) ? SS_TuneIndicator : 'U');
         OutputSetDisplayMuteIndicator(SS_MuteIndicator);
     } else // "not Tuning" means "in menu"
     {
@@ -2519,9 +4781,18 @@ void OutputHandler(void)
 
         TopLinePrinter   (SS_MenuState);
         BottomLinePrinter(SS_MenuState);
+        SMeterLevel = SMETERUNKNOWN; // bottom line is overwritten by the menu
     }
+    // only send the changed characters to the display
+    lcdFlush();
 
-    OutputSetVfoFrequency (SS_VfoFrequency);
+    // a changed reference or fastlock setting is committed together with the vfo word
+    PllSet(PLL_FUNC, PllFunctionWord(SS_FastLock));
+    OutputSetPLLReference(SS_PllReferenceFrequency);
+    OutputSetVfoWord(SS_Transmitting);
+
+    // don't transmit or look at the S-meter before the PLL is on frequency
+    OutputPllSettle();
     OutputSetTransmitterOn(SS_Transmitting);
 
 }
@@ -2542,6 +4813,9 @@ int results;
 void mainLoop(void)
 {
     char busy = TRUE;
+#ifdef TESTING
+    uint32_t vco;
+#endif
 
     while (busy)
     {
@@ -2579,85 +4853,111 @@ void mainLoop(void)
         if (TRUE)
         {
             ttySetCursorPosition(DBGROW,0);
-            printf("\033[37m"); // light gray
-            printf("\n========================= debug ========================"); 
+            ttyPrintf("\033[37m"); // light gray
+            ttyPrintf("\n========================= debug ========================"); 
             NL();
-            printf("CTCSSindex      =      %3d  | ",SS_CtcssIndex);
-            printf("SS_Tuning       =        %d",SS_Tuning);
+            ttyPrintf("CTCSSindex      =      %3d  | ",SS_CtcssIndex);
+            ttyPrintf("SS_Tuning       =        %d",SS_Tuning);
             NL();
             //            printf("inputStateRotary= %8d\n",inputStateRotary);
 
-            printf("CTCSSfrequency  = %8d  | ",SS_CtcssFrequency);
-            printf("SS_MenuState    =     %04X",SS_MenuState ); 
+            ttyPrintf("CTCSSfrequency  = %8d  | ",SS_CtcssFrequency);
+            ttyPrintf("SS_MenuState    =     %04X",SS_MenuState ); 
             NL();
 
-            printf("MuteLevel       = %8d  | ",SS_MuteLevel);
-            printf("SS_ValueEdit    = %8d",SS_ValueEdit);
+            ttyPrintf("MuteLevel       = %8d  | ",SS_MuteLevel);
+            ttyPrintf("SS_ValueEdit    = %8d",SS_ValueEdit);
             NL();
 
-            printf("ShiftEnable     =      %3s  | ",yesno(SS_ShiftEnable));
+            ttyPrintf("ShiftEnable     =      %3s  | ",yesno(SS_ShiftEnable));
             //printf("menuLoopState T =     %04X",menuLoopState & TYPEMASK); 
             NL();
 
-            printf("SS_FastTune     =      %3s  | ",yesno(SS_FastTune));
-            printf("stepsCounter    = %8d",stepsCounter);
+            ttyPrintf("SS_FastTune     =      %3s  | ",yesno(SS_FastTune));
+            ttyPrintf("stepsCounter    = %8d",stepsCounter);
+            NL();
+
+            ttyPrintf("FrequencyShift  = %8d  | ",SS_FrequencyShift);
+            ttyPrintf("BaseFrequency   = %8d",SS_BaseFrequency); 
+            NL();
+
+            ttyPrintf("Transmitting    =      %3s  | ",yesno(SS_Transmitting));
+            ttyPrintf("VfoFrequency    = %8d",SS_VfoFrequency);
             NL();
 
-            printf("FrequencyShift  = %8d  | ",SS_FrequencyShift);
-            printf("BaseFrequency   = %8d",SS_BaseFrequency); 
+            ttyPrintf("Scanning        =      %3s  | ",yesno(SS_Scanning));
+            ttyPrintf("SS_PllReference = %4u.%06u", SS_PllReferenceFrequency/ONEMHZ, SS_PllReferenceFrequency%ONEMHZ);
             NL();
 
-            printf("Transmitting    =      %3s  | ",yesno(SS_Transmitting));
-            printf("VfoFrequency    = %8d",SS_VfoFrequency);
+            ttyPrintf("Scan Start      = %4u.%06u  | ", SS_ScanStartFrequency/ONEMHZ, SS_ScanStartFrequency%ONEMHZ);
+            ttyPrintf("Scan End        = %4u.%06u", SS_ScanEndFrequency/ONEMHZ, SS_ScanEndFrequency%ONEMHZ);
             NL();
 
-            printf("Scanning        =      %3s  | ",yesno(SS_Scanning));
-            printf("SS_PllReference = %4u.%03u", SS_PllReferenceFrequency/1000, SS_PllReferenceFrequency%1000);
+            ttyPrintf("SS_SMeterIn     =    %5d  | ", (int)SS_SMeterIn);
+            ttyPrintf("SS_DisplaySMeter=    %5d", (int)SS_DisplaySMeter);
             NL();
 
-            printf("Scan Start      = %4u.%03u  | ", SS_ScanStartFrequency/1000, SS_ScanStartFrequency%1000);
-            printf("Scan End        = %4u.%03u", SS_ScanEndFrequency/1000, SS_ScanEndFrequency%1000);
+            ttyPrintf("SS_RotaryCount  =    %5d  | ", SS_RotaryCount);
+            ttyPrintf("SS_Selected     =        %1d", SS_Selected);
             NL();
 
-            printf("SS_SMeterIn     =    %5d  | ", (int)SS_SMeterIn);
-            printf("SS_DisplaySMeter=    %5d", (int)SS_DisplaySMeter);
+            ttyPrintf("tmpFreqChanged  =    %5d  | ", tmpFreqChanged);
+            ttyPrintf("tmpFreqSaved    =    %5d ", tmpFreqSaved);
             NL();
 
-            printf("SS_RotaryCount  =    %5d  | ", SS_RotaryCount);
-            printf("SS_Selected     =        %1d", SS_Selected);
+            ttyPrintf("testNr          =    %5d  | ", testNr);
             NL();
 
-            printf("tmpFreqChanged  =    %5d  | ", tmpFreqChanged);
-            printf("tmpFreqSaved    =    %5d ", tmpFreqSaved);
+            ttyPrintf("stepTime        =    %5u  | ",stepTime);
             NL();
 
-            printf("testNr          =    %5d  | ", testNr);
+            ttyPrintf("Inactivity time =    %5u  | ",currentTime - channelCloseTime) ;
+            ttyPrintf("ScanResumeDelay =    %5d ", ScanResumeDelay);
             NL();
 
-            printf("stepTime        =    %5u  | ",stepTime);
+            ttyPrintf("CGRAM slots used=    %5d  | ", lcdGlyphUsage());
+            ttyPrintf("CGRAM loads/hits= %5u/%u", glyphLoads, glyphHits);
             NL();
 
-            printf("Inactivity time =    %5u  | ",currentTime - channelCloseTime) ;
-            printf("ScanResumeDelay =    %5d ", ScanResumeDelay);
+            ttyPrintf("Loop us min/max = %5u/%-5u| ", simLoopMin, simLoopMax);
+            ttyPrintf("Loop us average =    %5u", simAverage(simLoopSum));
+            NL();
+
+            ttyPrintf("Loop us adc/pll = %5u/%-5u| ",
+                    simAverage(simCost[ST_INPUT][SC_ADC]), simAverage(simCost[ST_OUTPUT][SC_PLL]));
+            ttyPrintf("Loop us lcd/eep = %5u/%u",
+                    simAverage(simCost[ST_OUTPUT][SC_LCD]), simAverage(simCost[ST_PROCESS][SC_EEPROM]));
+            NL();
+
+            ttyPrintf("PTT to PLL us   = %5u/%-5u| ", pttLatency, pttLatencyMax);
+            ttyPrintf("PLL R/N         = %06X/%06X", pllChip[PLL_R], pllChip[PLL_N]);
+            NL();
+
+            ttyPrintf("PLL locked      =      %3s  | ", yesno(SS_PllLocked));
+            ttyPrintf("PLL unlocks     =    %5u", SS_PllUnlocks);
+            NL();
+
+            vco = simPllVco(SS_PllReferenceFrequency);
+            ttyPrintf("PLL bus VCO     = %4u.%06u| ", vco/ONEMHZ, vco%ONEMHZ);
+            ttyPrintf("PLL bus updates = %8u", simBus.updates);
             NL();
 
             // printf("ctcssIndex      = %8d\n",ctcssIndex);
             // printf("vInRotState     = %8d\n",vInRotState);
             // printf("keypressed  = %8X\n",theKey);
             // printf("unget charvail  = %8s\n",yesno(GetcAvail));
-            printf("========================================================\n"); NL();
-            printf("\033[30m"); // black
+            ttyPrintf("========================================================\n"); NL();
+            ttyPrintf("\033[30m"); // black
         }
         else
         {
             deSetCursorPosition(DBGROW,1);
         }
+        ttyRender(FALSE);
+        simLoopDone();
 #endif
         // }}}
     }
-
-    // $$$ DEBUG
-    tbi(PORTB, 2); // for measuring loop timing
 }
 
 
@@ -2669,6 +4969,8 @@ int main(int argc, char *argv[])
     // {{{ testing
 
 #ifdef TESTING
+    int failed;
+
     if (argc>1)
     {
         if (strcmp(argv[1],"-a") == 0)
@@ -2677,20 +4979,37 @@ int main(int argc, char *argv[])
             AutoTest = TRUE;
         if (strcmp(argv[1],"-d") == 0)
             dbg_logging = TRUE;
+        if (strcmp(argv[1],"-H") == 0)
+        {
+            AutoTest = TRUE;
+            Headless = TRUE;
+        }
     }
 
     TEST_Initialize();
 
+    // headless: no terminal at all, the test framework drives the loop
+    if (Headless)
+    {
+        initialize();
+        failed = TEST_Run();
+        simReport(stdout);
+        simReport(testlog);
+        return (failed == 0) ? 0 : 1;
+    }
+
     ttyClearScreen();
     ttySetCursorPosition(0,0);
-    printf("========= 23cm NBFM control software simulator =========\n");
-    printf("\n");
-    printf("q quit\n"); 
-    printf("[ downward rotating         ] upward rotating\n"); 
-    printf("t transmit                  r receive\n"); 
-    printf("s shift on                  a shift off\n");
-    printf("e menu selector button      l toggle large steps on/off\n"); 
-    printf("\n");
+    ttyPrintf("========= 23cm NBFM control software simulator =========\n\r");
+    ttyPrintf("\n\r");
+    ttyPrintf("q quit\n\r"); 
+    ttyPrintf("[ downward rotating         ] upward rotating\n\r"); 
+    ttyPrintf("t transmit                  r receive\n\r"); 
+    ttyPrintf("s shift on                  a shift off\n\r");
+    ttyPrintf("e menu selector button      l toggle large steps on/off\n\r"); 
+    ttyPrintf("f fast forward 10 seconds   u PLL lock fault on/off\n\r"); 
+    ttyPrintf("\n\r");
+    deFrame();  // the frame never changes, draw it once
     set_conio_terminal_mode();
 
     if (dbg_logging) dbg = fopen("log.txt","w");
@@ -2705,15 +5024,17 @@ int main(int argc, char *argv[])
 
 #ifdef TESTING
     eeprom=fopen("eeprom.bin","w");
-    for (int i=0; i<16; i++)
+    for (int i=0; i<PERSISTENTCOUNT; i++)
         fwrite(&theMenu[i].value, sizeof(int32_t),1, eeprom);
+    fseek(eeprom, MEMCHANEEPROM, SEEK_SET);
+    fwrite(memory, sizeof(memory), 1, eeprom);
     fclose(eeprom);
 
     if (dbg_logging) fclose(dbg);
-    // position cursor below lowest printed line
-    ttySetCursorPosition(14,0);
+    // show the last frame, then put the cursor below the lowest printed line
+    ttyRender(TRUE);
     // cursor back on
-    printf("\033[?25h");   
+    printf("\033[%d;1H\033[?25h\n", ttyMaxRow+2);
     // short i;
     // for (i=0x20; i<255; i++) printf("%X-%c ", i,i);
 #endif
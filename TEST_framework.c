@@ -21,24 +21,28 @@ struct TestDefinition
 
 struct TestDefinition tests[] =
 {// rot, sel,   shift, rever,  ptt, signal,      tx~rx,  mute,   tone,   topline         ,   bottomline
-                            //assume mutelevel = 10 
-    { 0, FALSE, FALSE, FALSE, FALSE, 980-2*12,   FALSE, FALSE,  FALSE, "VFO:1298.200 MHz", "M              R" }, 
-    { 1, FALSE, FALSE, FALSE, FALSE, 980-2*2 ,   FALSE,  TRUE,  FALSE, "VFO:1298.225 MHz", "M              R" }, 
-    {-1, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO:1298.200 MHz", "M              R" }, 
-    { 4, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO:1298.300 MHz", "M              R" }, 
-    {-8, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO:1298.100 MHz", "M              R" }, 
-    { 0, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO:1298.100 MHz", "M              R" }, 
-    { 0, FALSE, FALSE, FALSE, TRUE , 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO:1298.100 MHz", "M              T" }, 
-    { 0, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO:1298.100 MHz", "M              R" }, 
-    { 0, FALSE, TRUE , FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO:1298.100 MHz", "M              R" }, 
-    { 0, FALSE, TRUE , FALSE, TRUE , 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO:1270.100 MHz", "M              T" }
+                            //assume mutelevel = 10, close level 8, no squelch tail
+    { 0, FALSE, FALSE, FALSE, FALSE, 980-2*12,   FALSE, FALSE,  FALSE, "VFO 1298.200 MHz", "               R" },   // signal is the ADC filter output
+    { 1, FALSE, FALSE, FALSE, FALSE, 980-2*2 ,   FALSE,  TRUE,  FALSE, "VFO 1298.225 MHz", "M              R" }, 
+    {-1, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO 1298.200 MHz", "M              R" }, 
+    { 4, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO 1298.300 MHz", "M              R" }, 
+    {-8, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO 1298.100 MHz", "M              R" }, 
+    { 0, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO 1298.100 MHz", "M              R" }, 
+    { 0, FALSE, FALSE, FALSE, TRUE , 980-2*1 ,    TRUE,  TRUE,  FALSE, "VFO 1298.100 MHz", "M              T" }, 
+    { 0, FALSE, FALSE, FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO 1298.100 MHz", "M              R" }, 
+    { 0, FALSE, TRUE , FALSE, FALSE, 980-2*1 ,   FALSE,  TRUE,  FALSE, "VFO 1298.100 MHz", "M              R" }, 
+    { 0, FALSE, TRUE , FALSE, TRUE , 980-2*1 ,    TRUE,  TRUE,  FALSE, "VFO 1270.100 MHz", "M              T" }
 };
 
 int TotalTests;
+int TEST_Checks;        // timed and sweep checks done, see TEST_Check()
 int testNr;
 FILE *testlog;
 
 #define TESTLOG "./test_results.log"
+#define GENERATEDTESTS  5000    // number of random input vectors in a headless run
+#define TESTSEED        1       // seed for the random input vectors, keeps runs repeatable
+#define SWEEPMODES      6       // rx and tx, each without shift, with shift and reversed
 
 void TEST_Initialize(void) 
 {
@@ -56,7 +60,7 @@ int  TEST_GetNextTest(int testNr)
 {
     int rv;
 
-    if (testNr >= TotalTests)
+    if (testNr+1 >= TotalTests)
         rv = -1;
     else
         rv = testNr+1;
@@ -64,12 +68,17 @@ int  TEST_GetNextTest(int testNr)
 } 
 
 
+// set the inputs the way InputHandler() would have delivered them
+
 void TEST_SetInputs(int testNr) 
 {
-    IRQ_RotaryChange   = tests[testNr].rotaryChange;
-    IRQ_SelectorPushed = tests[testNr].selectorPushed;
+    SS_RotaryCount     = tests[testNr].rotaryChange;
+    SS_Selected        = tests[testNr].selectorPushed;
     SS_ShiftEnable     = tests[testNr].shiftEnable;
-    SS_PTT             = tests[testNr].ptt;
+    SS_ReverseShift    = tests[testNr].reverseShift;
+    SS_PTT             = (tests[testNr].ptt) ? 1 : 2;
+    SS_SMeterIn        = tests[testNr].signal;
+    SS_SMeterValid     = TRUE;
 }
 
 
@@ -110,3 +119,1127 @@ void TEST_Log(int testNr, int success)
     }
 }
 
+
+// {{{ Generated tests
+
+// Random inputs while tuning. There is no fixed expected value for these,
+// instead the outputs are checked for consistency with each other.
+
+void TEST_SetRandomInputs(void)
+{
+    SS_RotaryCount     = (rand() % 9) - 4;
+    SS_Selected        = FALSE;
+    SS_ShiftEnable     = (rand() % 4) == 0;
+    SS_ReverseShift    = (rand() % 8) == 0;
+    SS_PTT             = ((rand() % 4) == 0) ? 1 : 2;
+    SS_SMeterIn        = 980 - (rand() % 90);
+    SS_SMeterValid     = TRUE;
+}
+
+int TEST_CheckOutputs(void)
+{
+    int success = TRUE;
+    int32_t offset;
+    struct PllCounterStruct *pll;
+    char expected[32];
+
+    offset = (SS_ShiftEnable && (SS_Transmitting != SS_ReverseShift)) ? SS_FrequencyShift : 0L;
+
+    success &= (SS_Transmitting == (SS_PTT == 1));
+    success &= (!SS_Transmitting || SS_Muted);
+    success &= inbetween(SS_BaseFrequency, BANDBOTTOM, BANDTOP);
+    success &= (SS_DisplayFrequency == SS_BaseFrequency + offset);
+    success &= (SS_VfoFrequency     == SS_DisplayFrequency - ((SS_Transmitting) ? 0L : IF));
+
+    // the incrementally updated PLL counters match the full calculation,
+    // and the PLL got the word for the current vfo frequency
+    pll = (SS_Transmitting) ? &pllTx : &pllRx;
+    success &= (pll->freq == SS_VfoFrequency);
+    success &= ((int32_t)pll->b * PLLPRESCALER + pll->a == SS_VfoFrequency / SS_ChannelStep);
+    success &= (pllChip[PLL_N] == pll->reg);
+
+    // the display line as printf would have made it
+    if (SS_DisplayFrequency % 1000)
+        snprintf(expected, sizeof(expected), "VFO %4d.%04dMHz", SS_DisplayFrequency/1000000, (SS_DisplayFrequency%1000000)/100);
+    else
+        snprintf(expected, sizeof(expected), "VFO %4d.%03d MHz", SS_DisplayFrequency/1000000, (SS_DisplayFrequency%1000000)/1000);
+    success &= (strcmp(expected, LineT) == 0);
+    return success;
+}
+
+void TEST_LogOutputs(int testNr, int success)
+{
+    if (!success)
+    {
+        fprintf(testlog,"generated test %5d failed:\n", testNr);
+        fprintf(testlog,"  base : %d  shift: %d (%s) reverse: %s\n", SS_BaseFrequency, SS_FrequencyShift,
+                TEST_yesNo(SS_ShiftEnable), TEST_yesNo(SS_ReverseShift));
+        fprintf(testlog,"  txbit: %s  mute: %s\n", TEST_yesNo(SS_Transmitting), TEST_yesNo(SS_Muted));
+        fprintf(testlog,"  disp : %d  vfo: %d  rx: %d tx: %d latched: %06x\n", SS_DisplayFrequency, SS_VfoFrequency,
+                pllRx.freq, pllTx.freq, pllChip[PLL_N]);
+        fprintf(testlog,"  top  : %s\n", LineT);
+    }
+}
+
+// }}}
+// {{{ Timed tests
+
+// These use the virtual clock: minutes of radio time take milliseconds and
+// the outcome is the same on every run.
+
+void TEST_Check(char *name, int success, int *failed)
+{
+    TEST_Checks++;
+    fprintf(testlog, "%-40s %s\n", name, (success) ? "OK" : "FAILED");
+    *failed += !success;
+}
+
+// Step the simulated S-meter input to "level" and run the loop for "ms",
+// every pass taking at least "loopms" longer. Returns the S-meter value.
+
+uint16_t TEST_SMeterStep(int level, uint32_t ms, uint32_t loopms)
+{
+    uint64_t end = simMicros + ms*1000ULL;
+
+    simuls = level;
+    while (simMicros < end)
+    {
+        simHeldInputs();
+        simCharge(SC_DELAY, loopms*1000);
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+    }
+    return InputGetSMeter();
+}
+
+// One loop pass as the receiver sees it: the ADC reads "adc" while the
+// latched N word tunes the PLL to "freq", and no signal elsewhere.
+
+void TEST_RadioPass(uint32_t freq, uint16_t adc)
+{
+    simuls = (simPllVco(SS_PllReferenceFrequency) == freq - IF) ? adc : 980;
+    simHeldInputs();
+    SS_SMeterIn = InputGetSMeter();
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+}
+
+// Every feature starts from the same radio: receiving on the initial
+// frequency, 25 kHz raster, no shift, tone or scan, the squelch as from the
+// factory, no signal, and the loop settled on all of it.
+
+void TEST_TimedStart(void)
+{
+    SS_PTT            = 2;
+    SS_ShiftEnable    = FALSE;
+    SS_ReverseShift   = FALSE;
+    SS_FrequencyShift = INITIAL_SHIFT;
+    SS_CtcssIndex     = 0;
+    SS_CtcssFrequency = 0;
+    SS_ScanMode       = SM_NONE;
+    SS_Scanning       = FALSE;
+    SS_ScanStartFrequency = BANDBOTTOM;
+    SS_ScanEndFrequency   = BANDTOP;
+    SS_FastLock       = FL_OFF;
+    simPllFault       = FALSE;
+    SS_MuteLevel      = INITIAL_MUTELEVEL;
+    SS_SquelchClose   = INITIAL_SQUELCHCLOSE;
+    SS_SquelchMinOpen = INITIAL_SQUELCHMINOPEN;
+    SS_SquelchTail    = INITIAL_SQUELCHTAIL;
+    SS_SquelchAuto    = INITIAL_SQUELCHAUTO;
+    SS_SquelchMargin  = INITIAL_SQUELCHMARGIN;
+    SS_NoiseFloor     = 0;
+    simuls            = 980;
+    SS_SMeterIn       = 980;
+    if (SS_Raster != INITIAL_RASTER)
+        ProcSetRaster(INITIAL_RASTER);
+    SS_BaseFrequency  = INITIAL_FREQUENCY;
+    simFastForward(3000);
+}
+
+// Fast tuning, saving the tuned frequency and the band scanner.
+
+int TEST_TimedTuning(void)
+{
+    int failed = 0;
+    int i;
+    uint32_t start;
+    uint32_t steps;
+    uint32_t saves;
+
+    TEST_TimedStart();
+
+    // more than 5 steps within 100 ms switch to 1 MHz steps
+    for (i=0; i<7; i++)
+    {
+        simHeldInputs();
+        SS_RotaryCount = 1;
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+    }
+    TEST_Check("fast tune after quick steps", SS_FastTune, &failed);
+
+    // tuning stopped: back to channel steps, frequency saved after ~1 second
+    simFastForward(1500);
+    TEST_Check("slow tune after a pause", !SS_FastTune, &failed);
+    TEST_Check("tuned frequency saved", theMenu[5].value == SS_BaseFrequency, &failed);
+
+    // a quiet channel starts the scanner, one step every ScanStepDelay+1 cs
+    start = SS_BaseFrequency = SS_ScanStartFrequency;
+    SS_ScanMode = SM_STEP;
+    saves = simFrequencySaves;
+    simFastForward(60000);
+    steps = (SS_BaseFrequency - start) / SS_ChannelStep;
+    fprintf(testlog, "scanner made %u steps in 60 seconds, %u eeprom writes\n", steps, simFrequencySaves - saves);
+    TEST_Check("scanner steps", SS_Scanning && inbetween(steps, 5700/(ScanStepDelay+1), 6000/(ScanStepDelay+1)+1), &failed);
+    // only the start channel is saved, before the scanner resumes
+    TEST_Check("no frequency saves while scanning", simFrequencySaves <= saves+1, &failed);
+    saves = simFrequencySaves;
+    SS_ScanMode = SM_NONE;
+    SS_Scanning = FALSE;
+
+    // the channel the scan stopped on is saved, once
+    simFastForward(1000);
+    TEST_Check("frequency saved once after the scan", (simFrequencySaves == saves+1) &&
+            (theMenu[5].value == SS_BaseFrequency), &failed);
+
+    return failed;
+}
+
+// The PTT edges: the transmit word goes out first on the key, the
+// transmitter is off before the receive word on release.
+
+int TEST_TimedPtt(void)
+{
+    int failed = 0;
+    char transmitting;
+
+    TEST_TimedStart();
+
+    // the PTT edge programs the transmit word before the rest of the loop runs
+    simFastForward(100);
+    PIND &= ~(1<<PTT);
+    simPttTime = simMicros;
+    SS_PTT = InputGetPTT();             // first thing InputHandler() does
+    simHeldInputs();
+    TEST_Check("transmit word on the PTT edge", pllChip[PLL_N] == pllTx.reg, &failed);
+    fprintf(testlog, "PTT to PLL latch %u us\n", pttLatency);
+    TEST_Check("PTT to PLL latch within 1 ms", pttLatency < 1000, &failed);
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    PIND |= (1<<PTT);
+    SS_PTT = InputGetPTT();
+    simHeldInputs();
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+
+    // releasing the key with a shift: the transmitter is off and the audio
+    // muted when the receive word reaches the PLL
+    SS_ShiftEnable = TRUE;
+    simFastForward(100);
+    PIND &= ~(1<<PTT);
+    SS_PTT = InputGetPTT();
+    simHeldInputs();
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    transmitting = (PORTC & _BV(TXON)) != 0;
+    PIND |= (1<<PTT);
+    SS_PTT = InputGetPTT();
+    TEST_Check("transmitter off before the receive word", transmitting && (pllTx.freq != pllRx.freq) &&
+            ((simBus.latch[PLL_N] & ~PLLCPGAIN) == pllRx.reg) && (simBus.nPins == _BV(MUTE)), &failed);
+    simHeldInputs();
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    SS_ShiftEnable = FALSE;
+
+    return failed;
+}
+
+// The ADF4113 model: writes only on changes, lock detect and fastlock.
+
+int TEST_TimedPll(void)
+{
+    int failed = 0;
+    int i;
+    uint32_t writes;
+    uint32_t reference;
+    uint16_t unlocks;
+
+    TEST_TimedStart();
+
+    // nothing changes, nothing is sent to the PLL
+    writes = pllWrites;
+    simFastForward(1000);
+    TEST_Check("no PLL writes without changes", pllWrites == writes, &failed);
+
+    // a new reference is applied at once, with one R word
+    reference = SS_PllReferenceFrequency;
+    SS_PllReferenceFrequency = 10000000UL;
+    simFastForward(100);
+    TEST_Check("reference applied live", pllChip[PLL_R] == (2UL<<16) + ((10000000UL/SS_ChannelStep)<<2), &failed);
+    TEST_Check("one PLL write for the reference", pllWrites == writes+1, &failed);
+    SS_PllReferenceFrequency = reference;
+    simFastForward(100);
+
+    // a PLL that does not lock is flagged, once
+    unlocks = SS_PllUnlocks;
+    simPllFault = TRUE;
+    simHeldInputs();
+    SS_RotaryCount = 1;
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    simFastForward(100);
+    TEST_Check("unlock flagged", !SS_PllLocked && (SS_PllUnlocks == unlocks+1) &&
+            (lcdFrame[1][DISPLAY_WIDTH-2] == 'U'), &failed);
+
+    // the S-meter and the squelch keep working without lock
+    simuls = 900;
+    for (i=0; i<2000; i++)
+    {
+        simHeldInputs();
+        SS_SMeterIn = InputGetSMeter();
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+    }
+    TEST_Check("unlocked receiver not muted", (IRQ_SMeter == 900) && !SS_Muted, &failed);
+    simuls = 980;
+    SS_SMeterIn = 980;
+    simPllFault = FALSE;
+    simFastForward(3000);
+    simFastForward(100);
+    TEST_Check("lock detected again", SS_PllLocked, &failed);
+
+    // fastlock until locked: on for a jump, off again after lock
+    SS_FastLock = FL_SOFT;
+    simFastForward(100);
+    TEST_Check("fastlock enabled in the function latch", (pllChip[PLL_FUNC] & PLLFASTLOCK) != 0, &failed);
+    simPllFault = TRUE;
+    SS_BaseFrequency += ONEMHZ;
+    simFastForward(100);
+    TEST_Check("fastlock on a 1 MHz jump", (pllChip[PLL_N] & PLLCPGAIN) != 0, &failed);
+    simPllFault = FALSE;
+    simFastForward(100);
+    TEST_Check("fastlock ends after lock", (pllChip[PLL_N] & PLLCPGAIN) == 0, &failed);
+
+    // a single channel step keeps the low noise setting
+    simPllFault = TRUE;
+    simHeldInputs();
+    SS_RotaryCount = 1;
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    TEST_Check("no fastlock on a channel step", (pllChip[PLL_N] & PLLCPGAIN) == 0, &failed);
+    simPllFault = FALSE;
+    SS_FastLock = FL_OFF;
+    simFastForward(100);
+
+    return failed;
+}
+
+// The channel raster, switched at runtime.
+
+int TEST_TimedRaster(void)
+{
+    int failed = 0;
+
+    TEST_TimedStart();
+
+    // the 12.5 kHz raster: a new R word, half kHz channels, counters by addition
+    ProcSetRaster(RS_12K5);
+    simFastForward(100);
+    TEST_Check("R word follows the raster", pllChip[PLL_R] == (2UL<<16) + ((SS_PllReferenceFrequency/12500)<<2), &failed);
+    simHeldInputs();
+    SS_RotaryCount = 1;
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    TEST_Check("12.5 kHz step", TEST_CheckOutputs() && (SS_BaseFrequency % 25000 == 12500) &&
+            (strcmp(LineT+12, "5MHz") == 0), &failed);
+    SS_BaseFrequency += ONEMHZ;
+    simFastForward(100);
+    TEST_Check("1 MHz step on the 12.5 kHz raster", TEST_CheckOutputs(), &failed);
+    ProcSetRaster(RS_20K);
+    simFastForward(100);
+    TEST_Check("tuning moved onto the 20 kHz raster", (SS_BaseFrequency % 20000 == 0) && TEST_CheckOutputs(), &failed);
+    ProcSetRaster(RS_25K);
+    simFastForward(100);
+
+    return failed;
+}
+
+// The free running ADC, the S-meter filter and the squelch decision in
+// the ADC interrupt, as the scanner sees them.
+
+int TEST_TimedAdc(void)
+{
+    int failed = 0;
+    uint32_t start;
+    uint16_t fast;
+    uint16_t slow;
+    char scanning;
+    char muted;
+    uint64_t end;
+
+    TEST_TimedStart();
+
+    // the S-meter value comes from the ADC interrupt, reading it does not wait
+    simuls = 900;
+    simFastForward(1000);
+    TEST_Check("S-meter follows the ADC", InputGetSMeter() == 900, &failed);
+    fprintf(testlog, "ADC interrupts %u us per loop\n", simAverage(simCost[ST_INPUT][SC_ADC]));
+    TEST_Check("no ADC wait in the loop", simAverage(simCost[ST_INPUT][SC_ADC]) < ADCCONVERSION/10, &failed);
+
+    // the S-meter filter runs at the ADC rate: a slow main loop gets the
+    // same fast attack and slow decay
+    simuls = 980;
+    simFastForward(3000);
+    fast = TEST_SMeterStep(900, 200, 0);
+    slow = TEST_SMeterStep(980, 200, 0);
+    fprintf(testlog, "S-meter after 200 ms: attack %u decay %u (fast loop)\n", fast, slow);
+    TEST_Check("S-meter attack and decay", (fast <= 902) && inbetween(slow, 980-40, 980-20), &failed);
+    simFastForward(3000);
+    fast = TEST_SMeterStep(900, 200, 20);
+    slow = TEST_SMeterStep(980, 200, 20);
+    fprintf(testlog, "S-meter after 200 ms: attack %u decay %u (20 ms loop)\n", fast, slow);
+    TEST_Check("S-meter response with a slow loop", (fast <= 902) && inbetween(slow, 980-40, 980-20), &failed);
+
+    // a burst between two loop passes: the main loop never sees it, the ADC
+    // interrupt opens the audio and the scanner stays on the channel
+    // (the filter settles first, it would open the squelch itself)
+    simuls = 980;
+    simFastForward(2000);
+    SS_ScanMode = SM_STEP;
+    SS_Scanning = TRUE;
+    simFastForward(1000);
+    start = SS_BaseFrequency;
+    scanning = SS_Scanning;
+    simuls = 850;
+    simCharge(SC_DELAY, 60000);
+    simAdcService();
+    TEST_Check("burst opens the audio in the interrupt", IRQ_SquelchOpen && !(PORTC & _BV(MUTE)), &failed);
+    simuls = 980;
+    simCharge(SC_DELAY, 300000);
+    simHeldInputs();
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    // the main loop takes over the opening, the tail keeps it open
+    TEST_Check("scanner stops on a burst it did not see", scanning && !SS_Scanning && !SS_Muted &&
+            (SS_BaseFrequency == start), &failed);
+    SS_ScanMode = SM_NONE;
+    simFastForward(500);
+
+    // a weak carrier just at the open level (ADC 960 is level 10) on one
+    // channel of a 40 channel scan: the filter has to settle within the dwell
+    SS_ScanStartFrequency = 1296000000UL;
+    SS_ScanEndFrequency   = 1297000000UL;
+    SS_BaseFrequency      = SS_ScanStartFrequency;
+    start = 1296500000UL;
+    SS_ScanMode = SM_STEP;
+    SS_Scanning = TRUE;
+    end = simMicros + 10000000ULL;
+    while ((simMicros < end) && SS_Scanning)
+        TEST_RadioPass(start, 960);
+    fprintf(testlog, "weak carrier scan stopped at %u Hz\n", SS_BaseFrequency);
+    TEST_Check("scan stops on a weak carrier", !SS_Scanning && (SS_BaseFrequency == start), &failed);
+    SS_ScanMode = SM_NONE;
+    SS_ScanStartFrequency = BANDBOTTOM;
+    SS_ScanEndFrequency   = BANDTOP;
+    simuls = 980;
+    SS_SMeterIn = 980;
+    simFastForward(2000);
+
+    // the ADC interrupt opens on the old channel after the scanner stepped,
+    // before the new N word: the new channel is quiet, the scan goes on
+    SS_ScanMode = SM_STEP;
+    SS_Scanning = TRUE;
+    simFastForward(1000);
+    start = SS_BaseFrequency;
+    end = simMicros + 1000000ULL;
+    while ((SS_BaseFrequency == start) && (simMicros < end))
+    {
+        simHeldInputs();
+        ProcessingHandler();
+        if (SS_BaseFrequency != start)
+        {
+            IRQ_SquelchOpen = TRUE;
+            IRQ_Carrier = TRUE;
+            cbi(PORTC, MUTE);
+        }
+        OutputHandler();
+        simLoopDone();
+    }
+    muted = (PORTC & _BV(MUTE)) != 0;
+    simFastForward(200);
+    TEST_Check("no stop on an opening from the old channel", muted && SS_Scanning &&
+            (SS_BaseFrequency != start+SS_ChannelStep), &failed);
+    SS_ScanMode = SM_NONE;
+    simFastForward(500);
+
+    return failed;
+}
+
+// The hysteresis squelch: close level, minimum open time and tail.
+
+int TEST_TimedSquelch(void)
+{
+    int failed = 0;
+    char muted;
+    char opened;
+    int changes;
+    uint64_t end;
+
+    TEST_TimedStart();
+
+    // squelch: open at 10, close below 6, 0.2 s tail
+    SS_MuteLevel      = 10;
+    SS_SquelchClose   = 6;
+    SS_SquelchMinOpen = 0;
+    SS_SquelchTail    = 20;
+
+    // a weak signal fluttering across both levels every 50 ms opens once
+    changes = 0;
+    muted = SS_Muted;
+    end = simMicros + 2000000ULL;
+    while (simMicros < end)
+    {
+        SS_SMeterIn = ((simMicros / 50000) & 1) ? 980-2*2 : 980-2*12;
+        simFastForward(1);
+        changes += (SS_Muted != muted);
+        muted = SS_Muted;
+    }
+    fprintf(testlog, "fluttering signal: %d mute changes in 2 seconds\n", changes);
+    TEST_Check("no mute chatter on a fluttering signal", changes == 1, &failed);
+
+    // the signal is gone: open for the tail time, then closed
+    SS_SMeterIn = 980-2*2;
+    simFastForward(100);
+    opened = !SS_Muted;
+    simFastForward(200);
+    TEST_Check("squelch tail", opened && SS_Muted, &failed);
+
+    // between the levels nothing changes
+    SS_SMeterIn = 980-2*8;
+    simFastForward(500);
+    muted = SS_Muted;
+    SS_SMeterIn = 980-2*12;
+    simFastForward(50);
+    opened = !SS_Muted;
+    SS_SMeterIn = 980-2*8;
+    simFastForward(1000);
+    TEST_Check("squelch hysteresis", muted && opened && !SS_Muted, &failed);
+
+    // a short opening lasts the minimum open time, even without tail
+    SS_SquelchTail    = 0;
+    SS_SquelchMinOpen = 50;
+    SS_SMeterIn = 980-2*2;
+    simFastForward(100);
+    SS_SMeterIn = 980-2*12;
+    simFastForward(1);
+    SS_SMeterIn = 980-2*2;
+    simFastForward(300);
+    opened = !SS_Muted;
+    simFastForward(300);
+    TEST_Check("minimum open time", opened && SS_Muted, &failed);
+
+    SS_SquelchClose   = INITIAL_SQUELCHCLOSE;
+    SS_SquelchMinOpen = INITIAL_SQUELCHMINOPEN;
+    SS_SquelchTail    = INITIAL_SQUELCHTAIL;
+
+    return failed;
+}
+
+// The auto squelch on the noise floor.
+
+int TEST_TimedAutoSquelch(void)
+{
+    int failed = 0;
+    char opened;
+    int changes;
+    uint16_t noise;
+    uint64_t end;
+
+    TEST_TimedStart();
+
+    // auto squelch, 8 above the floor: after quiet, noise of 18..22 arrives
+    // and opens it, the floor follows and the squelch closes again
+    SS_SquelchAuto   = TRUE;
+    SS_SquelchMargin = 8;
+    end = simMicros + 90000000ULL;
+    while (simMicros < end)
+    {
+        SS_SMeterIn = 980 - 2*(18 + rand() % 5);
+        simFastForward(1);
+    }
+    TEST_Check("auto squelch follows a rising noise floor", SS_Muted &&
+            inbetween(SS_NoiseFloor >> NOISEFLOORFRACTION, 17, 19), &failed);
+
+    // the settled floor gives no stops on the noise, a weak station opens
+    changes = 0;
+    end = simMicros + 10000000ULL;
+    while (simMicros < end)
+    {
+        SS_SMeterIn = 980 - 2*(18 + rand() % 5);
+        simFastForward(1);
+        changes += !SS_Muted;
+    }
+    fprintf(testlog, "noise floor %d.%02d, %d loops open\n", SS_NoiseFloor >> NOISEFLOORFRACTION,
+            100 * (SS_NoiseFloor & ((1 << NOISEFLOORFRACTION) - 1)) >> NOISEFLOORFRACTION, changes);
+    TEST_Check("auto squelch stays closed on noise", changes == 0, &failed);
+
+    // scanning the same noise: the retunes leave the floor alone, no stops
+    noise = SS_NoiseFloor;
+    SS_ScanMode = SM_STEP;
+    SS_Scanning = TRUE;
+    changes = 0;
+    end = simMicros + 30000000ULL;
+    while (simMicros < end)
+    {
+        simuls = 980 - 2*(18 + rand() % 5);
+        simHeldInputs();
+        SS_SMeterIn = InputGetSMeter();
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+        changes += !SS_Scanning;
+    }
+    fprintf(testlog, "noise floor %d after 30 seconds of scanning, %d loops stopped\n",
+            SS_NoiseFloor >> NOISEFLOORFRACTION, changes);
+    TEST_Check("auto squelch scan does not stop on noise", (changes == 0) &&
+            inbetween(SS_NoiseFloor >> NOISEFLOORFRACTION, 17, 21), &failed);
+    SS_ScanMode = SM_NONE;
+    SS_Scanning = FALSE;
+    simuls = 980;
+
+    // back on one channel with the floor settled on it
+    SS_NoiseFloor = noise;
+    SS_SMeterIn = 980 - 2*29;
+    simFastForward(50);
+    opened = !SS_Muted;
+
+    // a strong station held for a minute hardly raises the floor
+    SS_SMeterIn = 980 - 2*45;
+    simFastForward(60000);
+    fprintf(testlog, "noise floor %d after a minute of carrier\n", SS_NoiseFloor >> NOISEFLOORFRACTION);
+    TEST_Check("auto squelch opens and holds a station", opened && !SS_Muted &&
+            inbetween(SS_NoiseFloor >> NOISEFLOORFRACTION, 17, 25), &failed);
+    SS_SquelchAuto = INITIAL_SQUELCHAUTO;
+
+    return failed;
+}
+
+// The S-meter curve and its two point calibration from the menu.
+
+int TEST_TimedCalibration(void)
+{
+    int failed = 0;
+    char flagged;
+
+    TEST_TimedStart();
+
+    // uncalibrated, the curve is the old 2 ADC steps per level
+    TEST_Check("S-meter curve", (SMeterScale(1023) == 0) && (SMeterScale(980-2*12) == 12) &&
+            (SMeterScale(SMETERTABLEBASE-1) == SMETERMAXLEVEL), &failed);
+
+    // calibration: select records the S-meter with the signal generator on
+    SS_Tuning    = FALSE;
+    SS_ValueEdit = TRUE;
+    SS_MenuState = MSMCALLOW;
+    SS_SMeterIn  = 950;
+    ProcSelectDuringEdit();
+    // a reading on the flat top of the curve is not taken
+    SS_ValueEdit = TRUE;
+    SS_MenuState = MSMCALHIGH;
+    SS_SMeterIn  = 850;
+    BottomLinePrinter(SS_MenuState);
+    flagged = (strstr(LineB, "Out of range") != NULL);
+    ProcSelectDuringEdit();
+    TEST_Check("S-meter calibration off the slope", flagged && (theMenu[MSMCALHIGH].value == 0) &&
+            (SS_SMeterGain == 256) && (SS_SMeterOffset == 0), &failed);
+    SS_ValueEdit = TRUE;
+    SS_SMeterIn  = 880;
+    ProcSelectDuringEdit();
+    fprintf(testlog, "S-meter calibration: gain %d/256 offset %d, top level %d\n", SS_SMeterGain, SS_SMeterOffset,
+            SMeterScale(SMETERTABLEBASE-1));
+    TEST_Check("S-meter two point calibration", (SMeterScale(950) == SMETERLEVEL(SMCALLOWDBM)) &&
+            (SMeterScale(880) == SMETERLEVEL(SMCALHIGHDBM)) && (SMeterScale(900) == 27) &&
+            (SMeterScale(SMETERTABLEBASE-1) >= 3*SMETERCELLS), &failed);
+    theMenu[MSMCALLOW].value  = 0;
+    theMenu[MSMCALHIGH].value = 0;
+    SMeterCalibrate();
+    SS_Tuning    = TRUE;
+    SS_ValueEdit = FALSE;
+    SS_SMeterIn  = 980;
+    simFastForward(500);
+
+    return failed;
+}
+
+// Memory channels: saving one, the channel scan and back to the VFO.
+
+int TEST_TimedMemoryScan(void)
+{
+    int failed = 0;
+    int i;
+    uint32_t start;
+    uint32_t steps;
+    char applied;
+    uint32_t visited;
+    int32_t shift;
+    uint64_t end;
+
+    TEST_TimedStart();
+
+    // save channel 3 from the menu: frequency, shift (switched on) and tone
+    SS_BaseFrequency  = 1298200000UL;
+    SS_ShiftEnable    = TRUE;
+    SS_CtcssIndex     = 5;
+    SS_CtcssFrequency = CtcssTones[5];
+    SS_Tuning    = FALSE;
+    SS_ValueEdit = TRUE;
+    SS_MenuState = MSCSAVE;
+    theMenu[MSCSAVE].value = 3;
+    ProcSelectDuringEdit();
+    TEST_Check("save memory channel", (memory[2].frequency == 1298200000L) &&
+            (memory[2].shift == SS_FrequencyShift) && (memory[2].ctcss == CtcssTones[5]) &&
+            !memory[1].frequency && !memory[3].frequency, &failed);
+    SS_Tuning    = TRUE;
+    SS_ValueEdit = FALSE;
+
+    // 32 repeaters, every 2nd with a shift, every 3rd with a tone: the
+    // scan visits all of them within seconds, each with its own settings
+    for (i=0; i<MEMCHANCOUNT; i++)
+    {
+        memory[i].frequency = 1270000000L + i*125000L;
+        memory[i].shift     = (i & 1) ? -6000000L : 0;
+        memory[i].ctcss     = (i % 3) ? 0 : CtcssTones[1 + i/3];
+    }
+    shift = SS_FrequencyShift;
+    SS_Tuning    = FALSE;
+    SS_MenuState = MSCMEMORY;
+    ProcSelectDuringMenu();
+    visited = 0;
+    applied = TRUE;
+    start = sysClock();
+    while ((visited != 0xFFFFFFFFUL) && ((sysClock() - start) < 3000))
+    {
+        simHeldInputs();
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+        i = SS_MemoryIndex;
+        visited |= 1UL << i;
+        applied = applied && (SS_BaseFrequency == memory[i].frequency) &&
+            (SS_ShiftEnable == (memory[i].shift != 0)) && (SS_CtcssFrequency == memory[i].ctcss);
+    }
+    steps = sysClock() - start;
+    fprintf(testlog, "memory scan over %d channels took %u.%02u s\n", MEMCHANCOUNT, steps / 100, steps % 100);
+    TEST_Check("memory scan visits every channel", (visited == 0xFFFFFFFFUL) && applied &&
+            (SS_ScanMode == SM_CHANNEL) && (steps < 500), &failed);
+
+    // a repeater comes up on channel 7: the scan stops there
+    end = simMicros + 3000000ULL;
+    while (simMicros < end)
+    {
+        SS_SMeterIn = (SS_MemoryIndex == 7) ? 980-2*20 : 980;
+        simFastForward(1);
+    }
+    TEST_Check("memory scan stops on a busy channel", !SS_Scanning && (SS_MemoryIndex == 7) &&
+            (SS_BaseFrequency == memory[7].frequency) && SS_ShiftEnable, &failed);
+
+    // the shift switch goes off on the channel: that is for the VFO
+    simHeldInputs();
+    SS_ShiftChange = 2;
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    SS_ShiftChange = 0;
+    TEST_Check("shift switch on a memory channel", SS_ShiftEnable && SS_MemoryChannel, &failed);
+
+    // tuning away from the channel: the VFO shift (as switched) and tone
+    // are back, in the menu too, and the channel scan is over
+    simHeldInputs();
+    SS_RotaryCount = 1;
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    TEST_Check("VFO settings back after the channel", !SS_ShiftEnable && (SS_FrequencyShift == shift) &&
+            (SS_CtcssIndex == 5) && (SS_CtcssFrequency == CtcssTones[5]) &&
+            (theMenu[MSHIFT].value == shift) && (theMenu[MCTCSS].value == 5) &&
+            (SS_ScanMode == SM_NONE) && !SS_MemoryChannel, &failed);
+
+    memset(memory, 0, sizeof(memory));
+    SS_ScanMode       = SM_NONE;
+    SS_ShiftEnable    = FALSE;
+    SS_FrequencyShift = INITIAL_SHIFT;
+    SS_CtcssIndex     = 0;
+    SS_CtcssFrequency = 0;
+    SS_BaseFrequency  = INITIAL_FREQUENCY;
+
+    SS_SMeterIn = 980;
+    simFastForward(500);
+
+    return failed;
+}
+
+int TEST_RunTimed(void)
+{
+    int failed = 0;
+
+    failed += TEST_TimedTuning();
+    failed += TEST_TimedPtt();
+    failed += TEST_TimedPll();
+    failed += TEST_TimedRaster();
+    failed += TEST_TimedAdc();
+    failed += TEST_TimedSquelch();
+    failed += TEST_TimedAutoSquelch();
+    failed += TEST_TimedCalibration();
+    failed += TEST_TimedMemoryScan();
+
+    return failed;
+}
+
+// }}}
+// {{{ Band sweep
+
+// Every channel of the band in receive and transmit, without shift, with
+// shift and with reversed shift. Checked on the decoded PLL bus, not on
+// the PLL counter code: the latches tune the VCO to the right frequency,
+// every update is one 24 bit word and a channel step costs one N word.
+
+int TEST_RunSweep(void)
+{
+    int failed = 0;
+    int mode;
+    char name[48];
+    int32_t  freq;
+    int32_t  expect;
+    uint32_t channels;
+    uint32_t mistuned;
+    uint32_t costly;
+    uint32_t updates;
+    uint32_t clocks;
+    uint32_t bad = simBus.badUpdates;
+
+    SS_ScanMode = SM_NONE;
+    SS_Scanning = FALSE;
+    SS_SMeterIn = 980;
+    for (mode=0; mode<SWEEPMODES; mode++)
+    {
+        SS_PTT          = (mode & 1) ? 1 : 2;
+        SS_ShiftEnable  = (mode >= 2);
+        SS_ReverseShift = (mode >= 4);
+        SS_BaseFrequency = BANDBOTTOM - SS_ChannelStep;
+        simFastForward(100);
+
+        channels = mistuned = costly = 0;
+        for (freq=BANDBOTTOM; freq<BANDTOP; freq+=SS_ChannelStep)
+        {
+            updates = simBus.updates;
+            clocks  = simBus.clocks;
+            simHeldInputs();
+            SS_BaseFrequency = freq;
+            ProcessingHandler();
+            OutputHandler();
+            simLoopDone();
+
+            if (mode & 1)
+                expect = freq + ((SS_ShiftEnable && !SS_ReverseShift) ? SS_FrequencyShift : 0);
+            else
+                expect = freq - IF + ((SS_ShiftEnable && SS_ReverseShift) ? SS_FrequencyShift : 0);
+            if (simPllVco(SS_PllReferenceFrequency) != (uint32_t)expect)
+            {
+                if (!mistuned)
+                    fprintf(testlog, "sweep mode %d: %d Hz tuned to %u Hz\n",
+                            mode, expect, simPllVco(SS_PllReferenceFrequency));
+                mistuned++;
+            }
+            if ((simBus.updates - updates != 1) || (simBus.clocks - clocks != 24))
+                costly++;
+            channels++;
+        }
+
+        snprintf(name, sizeof(name), "sweep %s%s: %u channels tuned", (mode & 1) ? "tx" : "rx",
+                (mode >= 4) ? " reverse" : (mode >= 2) ? " shift" : "", channels);
+        TEST_Check(name, (mistuned == 0) && (channels == (BANDTOP-BANDBOTTOM)/SS_ChannelStep), &failed);
+        snprintf(name, sizeof(name), "sweep %s%s: one 24 bit word a step", (mode & 1) ? "tx" : "rx",
+                (mode >= 4) ? " reverse" : (mode >= 2) ? " shift" : "");
+        TEST_Check(name, (costly == 0) && (simBus.badUpdates == bad), &failed);
+    }
+
+    SS_PTT          = 2;
+    SS_ShiftEnable  = FALSE;
+    SS_ReverseShift = FALSE;
+    SS_BaseFrequency = INITIAL_FREQUENCY;
+    simFastForward(100);
+    return failed;
+}
+
+// }}}
+// {{{ Display
+
+// The frame buffer, the S-meter bar and the glyph cache, checked on what
+// reaches the display controller. Each test puts the frame back as it found it.
+
+// LCD bytes sent so far, commands and data
+
+uint32_t TEST_LcdBytes(void)
+{
+    uint64_t cost = 0;
+    int stage;
+
+    for (stage=0; stage<SIMSTAGES; stage++)
+        cost += simCost[stage][SC_LCD];
+    return cost / SIMLCDBYTE;
+}
+
+// lcdFlush() sends only the changed cells, a run of them after one cursor command
+
+int TEST_DisplayFlush(void)
+{
+    int failed = 0;
+    char frame[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+    uint32_t bytes, cmds;
+
+    TEST_TimedStart();
+    memcpy(frame, lcdFrame, sizeof(frame));
+    lcdFlush();
+
+    // nothing changed, nothing sent
+    bytes = TEST_LcdBytes();
+    cmds  = simLcdCmds;
+    lcdFlush();
+    TEST_Check("unchanged frame sends nothing", (TEST_LcdBytes() == bytes) && (simLcdCmds == cmds), &failed);
+
+    // two runs on the top line, one cell below, one cell written unchanged
+    lcdFramePut(0, 2, '#');
+    lcdFramePut(0, 3, '#');
+    lcdFramePut(0, 4, '#');
+    lcdFramePut(0, 8, '#');
+    lcdFramePut(1, 5, '#');
+    lcdFramePut(1, 9, lcdFrame[1][9]);
+    bytes = TEST_LcdBytes();
+    cmds  = simLcdCmds;
+    lcdFlush();
+    cmds  = simLcdCmds - cmds;
+    bytes = TEST_LcdBytes() - bytes - cmds;
+    fprintf(testlog, "flush of 5 changed cells: %u cursor commands, %u data bytes\n", cmds, bytes);
+    TEST_Check("changed cells flushed in runs", (cmds == 3) && (bytes == 5) &&
+            (memcmp(lcdFrame, lcdDdram, sizeof(lcdDdram)) == 0), &failed);
+
+    memcpy(lcdFrame, frame, sizeof(frame));
+    lcdFlush();
+    return failed;
+}
+
+// glyph shown in S-meter cell "cell", GL_NONE for a plain character
+
+uint8_t TEST_SMeterCell(int cell)
+{
+    uint8_t c = lcdFrame[1][1+cell];
+
+    return (c < GLYPHSLOTS) ? glyphSlot[c] : GL_NONE;
+}
+
+// The bar follows the level, the peak marker holds and then decays, and a
+// marker step only rewrites the cells it leaves and enters. The level is
+// driven through SS_SMeterIn, uncalibrated 2 ADC steps per level.
+
+int TEST_DisplaySMeter(void)
+{
+    int failed = 0;
+    int i;
+    char redrawn;
+    uint32_t bytes, cmds;
+    uint32_t stepBytes = 0, stepCmds = 0;
+
+    TEST_TimedStart();
+
+    // level 20: six full cells, two lines in the seventh
+    SS_SMeterIn = 980-2*20;
+    simFastForward(500);
+    TEST_Check("S-meter bar", (TEST_SMeterCell(0) == GL_BAR3) && (TEST_SMeterCell(5) == GL_BAR3) &&
+            (TEST_SMeterCell(6) == GL_BAR2) && (TEST_SMeterCell(7) == GL_NONE) && (SMeterPeakLevel == 20), &failed);
+
+    // down to level 5: the marker stays at 20 for the hold time
+    SS_SMeterIn = 980-2*5;
+    simFastForward(10 * (SMETERPEAKHOLD - SMETERPEAKDECAY));
+    TEST_Check("S-meter peak hold", (SMeterPeakLevel == 20) && (TEST_SMeterCell(6) == GL_PEAK) &&
+            (TEST_SMeterCell(1) == GL_BAR2) && (TEST_SMeterCell(2) == GL_NONE), &failed);
+
+    // then one level per decay time, the first right after the hold:
+    // 6 levels down at 5.5 decay times past it
+    simFastForward(10 * (SMETERPEAKDECAY + 5*SMETERPEAKDECAY + SMETERPEAKDECAY/2));
+    fprintf(testlog, "S-meter peak %d after %d cs\n", SMeterPeakLevel, SMETERPEAKHOLD + 5*SMETERPEAKDECAY + SMETERPEAKDECAY/2);
+    TEST_Check("S-meter peak decay", (SMeterPeakLevel == 14) && (TEST_SMeterCell(4) == GL_PEAK) &&
+            (TEST_SMeterCell(5) == GL_NONE) && (TEST_SMeterCell(6) == GL_NONE), &failed);
+
+    // 14 to 13 stays in cell 4, 13 to 12 moves it to cell 3: two cells, one run
+    while (SMeterPeakLevel > 12)
+    {
+        bytes = TEST_LcdBytes();
+        cmds  = simLcdCmds;
+        simHeldInputs();
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+        stepCmds  += simLcdCmds - cmds;
+        stepBytes += TEST_LcdBytes() - bytes - (simLcdCmds - cmds);
+    }
+    fprintf(testlog, "S-meter marker 14 to 12: %u cursor commands, %u data bytes\n", stepCmds, stepBytes);
+    TEST_Check("S-meter marker step redraws two cells", (stepCmds == 1) && (stepBytes == 2) &&
+            (TEST_SMeterCell(3) == GL_PEAK) && (TEST_SMeterCell(4) == GL_NONE), &failed);
+
+    // something else wrote the bottom line: the whole bar is drawn again
+    for (i=0; i<SMETERCELLS; i++)
+        lcdFramePut(1, 1+i, 'x');
+    SMeterLevel = SMETERUNKNOWN;
+    simHeldInputs();
+    ProcessingHandler();
+    OutputHandler();
+    simLoopDone();
+    redrawn = (TEST_SMeterCell(0) == GL_BAR3) && (TEST_SMeterCell(1) == GL_BAR2);
+    for (i=2; i<SMETERCELLS; i++)
+        redrawn = redrawn && ((i == (SMeterPeakLevel-1)/3) ? (TEST_SMeterCell(i) == GL_PEAK) : (lcdFrame[1][1+i] == ' '));
+    TEST_Check("S-meter full redraw", redrawn, &failed);
+
+    SS_SMeterIn = 980;
+    simFastForward(3000);
+    return failed;
+}
+
+// The glyph cache with the test glyphs, 10 for 8 slots: hits, least
+// recently used eviction, no eviction of a glyph on the screen (in the
+// frame or still in DDRAM), and the plain character when all are in use.
+
+int TEST_DisplayGlyphs(void)
+{
+    int failed = 0;
+    int id;
+    char frame[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+    char ddram[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+    uint8_t  slots[GLYPHSLOTS];
+    uint16_t used[GLYPHSLOTS];
+    uint16_t loads, hits;
+    uint32_t bytes;
+    char c;
+
+    memcpy(frame, lcdFrame, sizeof(frame));
+    memcpy(ddram, lcdDdram, sizeof(ddram));
+    memcpy(slots, glyphSlot, sizeof(slots));
+    memcpy(used, glyphUsed, sizeof(used));
+    lcdFrameInit();
+    lcdGlyphInit();
+
+    // the first 8 fill the slots in order
+    loads = glyphLoads;
+    for (id=0; id<GLYPHSLOTS; id++)
+        lcdGlyph(id);
+    TEST_Check("glyphs fill the empty slots", (glyphLoads == loads+GLYPHSLOTS) &&
+            (glyphSlot[0] == 0) && (glyphSlot[GLYPHSLOTS-1] == GLYPHSLOTS-1), &failed);
+
+    // a resident glyph is not sent again
+    loads = glyphLoads;
+    hits  = glyphHits;
+    bytes = TEST_LcdBytes();
+    c = lcdGlyph(GL_BAR3);
+    TEST_Check("glyph hit", (c == 2) && (glyphHits == hits+1) && (glyphLoads == loads) &&
+            (TEST_LcdBytes() == bytes), &failed);
+
+    // GL_BAR1 used again, GL_BAR2 is now the least recently used
+    lcdGlyph(GL_BAR1);
+    c = lcdGlyph(GL_TEST+2);
+    TEST_Check("glyph evicts the least recently used", (c == 1) && (glyphSlot[1] == GL_TEST+2) &&
+            (glyphLoads == loads+1) && (TEST_LcdBytes() == bytes+9), &failed);
+
+    // next in line are GL_PEAK (in the frame) and then GL_TX, GL_RX (in DDRAM)
+    lcdFramePut(1, 0, 3);
+    c = lcdGlyph(GL_TEST+3);
+    lcdDdram[0][0] = 5;
+    id = lcdGlyph(GL_BAR2);
+    TEST_Check("glyph on the screen is kept", (c == 4) && (glyphSlot[3] == GL_PEAK) &&
+            (id == 6) && (glyphSlot[5] == GL_RX), &failed);
+
+    // every slot on the screen: GL_TX can not be loaded
+    for (id=0; id<GLYPHSLOTS; id++)
+        lcdFramePut(0, id, id);
+    loads = glyphLoads;
+    c = lcdGlyph(GL_TX);
+    TEST_Check("glyph stand-in when all slots are shown", (c == GlyphText[GL_TX]) && (glyphLoads == loads), &failed);
+
+    memcpy(lcdFrame, frame, sizeof(frame));
+    memcpy(lcdDdram, ddram, sizeof(ddram));
+    memcpy(glyphSlot, slots, sizeof(slots));
+    memcpy(glyphUsed, used, sizeof(used));
+    return failed;
+}
+
+int TEST_RunDisplay(void)
+{
+    int failed = 0;
+
+    failed += TEST_DisplayFlush();
+    failed += TEST_DisplaySMeter();
+    failed += TEST_DisplayGlyphs();
+    return failed;
+}
+
+// }}}
+// {{{ int TEST_Run(void)
+
+// Headless test run: drives the processing and output handlers directly,
+// without keyboard polling and terminal output. Returns the number of failures.
+
+int TEST_Run(void)
+{
+    int n;
+    int success;
+    int failed = 0;
+
+    // the table checks the levels, one loop pass per row
+    SS_SquelchTail = 0;
+    for (n=0; n<TotalTests; n++)
+    {
+        simHeldInputs();
+        TEST_SetInputs(n);
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+        success = TEST_ExpectResults(n);
+        TEST_Log(n, success);
+        failed += !success;
+    }
+    SS_SquelchTail = INITIAL_SQUELCHTAIL;
+
+    srand(TESTSEED);
+    for (n=0; n<GENERATEDTESTS; n++)
+    {
+        simHeldInputs();
+        TEST_SetRandomInputs();
+        ProcessingHandler();
+        OutputHandler();
+        simLoopDone();
+        success = TEST_CheckOutputs();
+        TEST_LogOutputs(n, success);
+        failed += !success;
+    }
+
+    failed += TEST_RunTimed();
+    failed += TEST_RunSweep();
+    failed += TEST_RunDisplay();
+
+    fprintf(testlog, "%d tests, %d failed\n", TotalTests+GENERATEDTESTS+TEST_Checks, failed);
+    printf("%d tests, %d failed, see %s\n", TotalTests+GENERATEDTESTS+TEST_Checks, failed, TESTLOG);
+    return failed;
+}
+
+// }}}